@@ -0,0 +1,150 @@
+//
+// Created by ciaowhen on 2023/5/12.
+//
+
+#include "benchmark.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+LatencyRecorder::LatencyRecorder(size_t reserve):m_sorted(false)
+{
+    m_samples.reserve(reserve);
+}
+
+void LatencyRecorder::Merge(const LatencyRecorder &other)
+{
+    m_samples.insert(m_samples.end(), other.m_samples.begin(), other.m_samples.end());
+    m_sorted = false;
+}
+
+double LatencyRecorder::GetPercentile(double percent)
+{
+    if(m_samples.empty())
+    {
+        return 0;
+    }
+
+    if(!m_sorted)
+    {
+        std::sort(m_samples.begin(), m_samples.end());
+        m_sorted = true;
+    }
+
+    size_t index = static_cast<size_t>(percent / 100.0 * (m_samples.size() - 1) + 0.5);
+    return static_cast<double>(m_samples[std::min(index, m_samples.size() - 1)]);
+}
+
+BenchReporter::BenchReporter():m_format(OF_TEXT), m_scale(1.0)
+{
+
+}
+
+BenchReporter* BenchReporter::Instance()
+{
+    static BenchReporter reporter;
+    return &reporter;
+}
+
+bool BenchReporter::IsEnabled(const std::string &name) const
+{
+    return m_filter.empty() || name.find(m_filter) != std::string::npos;
+}
+
+size_t BenchReporter::Scaled(size_t ops) const
+{
+    return std::max(static_cast<size_t>(1), static_cast<size_t>(ops * m_scale));
+}
+
+void BenchReporter::Report(const std::string &name, size_t ops, double seconds, LatencyRecorder &latency)
+{
+    BenchResult result;
+    result.name = name;
+    result.ops = ops;
+    result.seconds = seconds;
+    result.ops_per_sec = seconds > 0 ? ops / seconds : 0;
+    result.p50_ns = latency.GetPercentile(50);
+    result.p99_ns = latency.GetPercentile(99);
+    Add(result);
+}
+
+void BenchReporter::Add(const BenchResult &result)
+{
+    m_results.push_back(result);
+    if(m_format == OF_TEXT)
+    {
+        printf("%-56s %12zu ops %14.0f ops/s   p50 %10.0f ns   p99 %10.0f ns",
+               result.name.c_str(), result.ops, result.ops_per_sec, result.p50_ns, result.p99_ns);
+        for(const auto &metric : result.metrics)
+        {
+            printf("   %s %.6g", metric.first.c_str(), metric.second);
+        }
+
+        printf("\n");
+        fflush(stdout);
+    }
+}
+
+bool BenchReporter::ParseOption(int argc, char *argv[], int &index)
+{
+    if(strcmp(argv[index], "--json") == 0)
+    {
+        SetFormat(OF_JSON);
+    }
+    else if(strcmp(argv[index], "--csv") == 0)
+    {
+        SetFormat(OF_CSV);
+    }
+    else if(strcmp(argv[index], "--filter") == 0 && index + 1 < argc)
+    {
+        SetFilter(argv[++index]);
+    }
+    else if(strcmp(argv[index], "--scale") == 0 && index + 1 < argc)
+    {
+        SetScale(atof(argv[++index]));
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void BenchReporter::Finish()
+{
+    if(m_format == OF_JSON)
+    {
+        printf("[\n");
+        for(size_t i = 0; i < m_results.size(); ++i)
+        {
+            const BenchResult &r = m_results[i];
+            printf("  {\"name\": \"%s\", \"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f",
+                   r.name.c_str(), r.ops, r.seconds, r.ops_per_sec, r.p50_ns, r.p99_ns);
+            for(const auto &metric : r.metrics)
+            {
+                printf(", \"%s\": %.10g", metric.first.c_str(), metric.second);
+            }
+
+            printf("}%s\n", i + 1 < m_results.size() ? "," : "");
+        }
+
+        printf("]\n");
+    }
+    else if(m_format == OF_CSV)
+    {
+        //附加指标放在最后一列, 形如"key=value;key=value"
+        printf("name,ops,seconds,ops_per_sec,p50_ns,p99_ns,metrics\n");
+        for(const auto &r : m_results)
+        {
+            printf("%s,%zu,%.6f,%.1f,%.1f,%.1f,", r.name.c_str(), r.ops, r.seconds, r.ops_per_sec, r.p50_ns, r.p99_ns);
+            for(size_t i = 0; i < r.metrics.size(); ++i)
+            {
+                printf("%s%s=%.10g", i > 0 ? ";" : "", r.metrics[i].first.c_str(), r.metrics[i].second);
+            }
+
+            printf("\n");
+        }
+    }
+}
@@ -0,0 +1,116 @@
+//
+// Created by ciaowhen on 2023/5/12.
+//
+
+#ifndef ADVANCECODE_BENCHMARK_H
+#define ADVANCECODE_BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+//微基准测试公共部分: 计时, 延迟采样和结果输出(文本/JSON/CSV)
+
+struct BenchResult
+{
+    std::string name;
+    size_t ops;
+    double seconds;
+    double ops_per_sec;
+    double p50_ns;
+    double p99_ns;
+    std::vector<std::pair<std::string, double>> metrics;    //各基准自己的附加指标, 按顺序输出
+};
+
+class LatencyRecorder
+{
+public:
+    explicit LatencyRecorder(size_t reserve = 0);
+    void Add(uint64_t ns) { m_samples.push_back(ns); }
+    void Merge(const LatencyRecorder &other);
+    double GetPercentile(double percent);               //percent取值0~100
+    size_t GetCount() const { return m_samples.size(); }
+
+private:
+    std::vector<uint64_t> m_samples;
+    bool m_sorted;
+};
+
+class BenchReporter
+{
+public:
+    enum OUTPUT_FORMAT
+    {
+        OF_TEXT = 0,
+        OF_JSON,
+        OF_CSV,
+    };
+
+    static BenchReporter *Instance();
+
+    void SetFormat(OUTPUT_FORMAT format) { m_format = format; }
+    void SetFilter(const std::string &filter) { m_filter = filter; }
+    void SetScale(double scale) { m_scale = scale; }
+
+    bool IsEnabled(const std::string &name) const;      //名字包含过滤串时才运行
+    size_t Scaled(size_t ops) const;                    //按--scale缩放迭代次数
+    //解析公共选项--json/--csv/--filter/--scale, 认识时返回true并跳过已用掉的参数
+    bool ParseOption(int argc, char *argv[], int &index);
+
+    void Report(const std::string &name, size_t ops, double seconds, LatencyRecorder &latency);
+    void Add(const BenchResult &result);
+    void Finish();
+
+private:
+    BenchReporter();
+
+    OUTPUT_FORMAT m_format;
+    std::string m_filter;
+    double m_scale;
+    std::vector<BenchResult> m_results;
+};
+
+inline uint64_t BenchNowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//按批计时: 每batch次操作采一个样本, 样本值为批内平均单次耗时, 避免计时开销淹没小操作
+template<class F>
+void RunBatched(const std::string &name, size_t ops, size_t batch, F &&op)
+{
+    BenchReporter *reporter = BenchReporter::Instance();
+    if(!reporter->IsEnabled(name))
+    {
+        return;
+    }
+
+    ops = reporter->Scaled(ops);
+    batch = batch == 0 ? 1 : batch;
+    LatencyRecorder latency(ops / batch + 1);
+    uint64_t begin = BenchNowNs();
+    size_t done = 0;
+    while(done < ops)
+    {
+        size_t count = std::min(batch, ops - done);
+        uint64_t batch_begin = BenchNowNs();
+        for(size_t i = 0; i < count; ++i)
+        {
+            op(done + i);
+        }
+
+        latency.Add((BenchNowNs() - batch_begin) / count);
+        done += count;
+    }
+
+    reporter->Report(name, ops, (BenchNowNs() - begin) / 1e9, latency);
+}
+
+void RunBufferBenchmarks();
+void RunBlockQueueBenchmarks();
+void RunThreadPoolBenchmarks();
+
+#endif //ADVANCECODE_BENCHMARK_H
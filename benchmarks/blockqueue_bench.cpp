@@ -0,0 +1,122 @@
+//
+// Created by ciaowhen on 2023/5/12.
+//
+
+#include "benchmark.h"
+#include "../log/blockqueue.h"
+#include "../log/mpmcqueue.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+//N个生产者推入带时间戳的元素, M个消费者逐个或成批取出, 统计吞吐和入队到出队的延迟
+//Queue为BlockDeque或MpmcQueue, 两者接口一致; 全部取完后关闭队列, 让还在等待的消费者返回
+template<class Queue>
+static void BenchProducers(const char *queue_name, int producer_num, int consumer_num, size_t capacity, bool drain)
+{
+    std::string name = std::string(queue_name) + (drain ? "/push_drain" : "/push_pop") + "/producers=" + std::to_string(producer_num)
+                       + "/consumers=" + std::to_string(consumer_num) + "/capacity=" + std::to_string(capacity);
+    BenchReporter *reporter = BenchReporter::Instance();
+    if(!reporter->IsEnabled(name))
+    {
+        return;
+    }
+
+    const size_t per_producer = reporter->Scaled(200000) / producer_num;
+    const size_t total = per_producer * producer_num;
+    Queue queue(capacity);
+    std::vector<LatencyRecorder> latencies(consumer_num, LatencyRecorder(total / consumer_num));
+    std::atomic<size_t> consumed(0);
+
+    uint64_t begin = BenchNowNs();
+    std::vector<std::thread> consumers;
+    for(int c = 0; c < consumer_num; ++c)
+    {
+        consumers.emplace_back([&, c]
+        {
+            LatencyRecorder &latency = latencies[c];
+            if(drain)
+            {
+                std::vector<uint64_t> stamps;
+                while(queue.DrainTo(stamps, capacity) > 0)
+                {
+                    uint64_t now = BenchNowNs();
+                    for(uint64_t stamp : stamps)
+                    {
+                        latency.Add(now - stamp);
+                    }
+
+                    consumed.fetch_add(stamps.size(), std::memory_order_relaxed);
+                    stamps.clear();
+                }
+                return;
+            }
+
+            //Close可能发生在消费者回到等待之前, 用检查关闭状态的等待, 不依赖两者的先后
+            uint64_t stamp = 0;
+            while(queue.PopFront(stamp, std::chrono::milliseconds(-1)))
+            {
+                latency.Add(BenchNowNs() - stamp);
+                consumed.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    std::vector<std::thread> producers;
+    for(int p = 0; p < producer_num; ++p)
+    {
+        producers.emplace_back([&]
+        {
+            for(size_t i = 0; i < per_producer; ++i)
+            {
+                queue.PushBack(BenchNowNs());
+            }
+        });
+    }
+
+    for(auto &producer : producers)
+    {
+        producer.join();
+    }
+
+    while(consumed.load(std::memory_order_relaxed) < total)
+    {
+        std::this_thread::yield();
+    }
+
+    uint64_t end = BenchNowNs();
+    queue.Close();
+    for(auto &consumer : consumers)
+    {
+        consumer.join();
+    }
+
+    LatencyRecorder latency;
+    for(auto &recorder : latencies)
+    {
+        latency.Merge(recorder);
+    }
+
+    reporter->Report(name, total, (end - begin) / 1e9, latency);
+}
+
+template<class Queue>
+static void BenchQueue(const char *queue_name)
+{
+    for(bool drain : {false, true})
+    {
+        for(int producer_num : {1, 2, 4, 8})
+        {
+            BenchProducers<Queue>(queue_name, producer_num, 1, 1024, drain);
+        }
+
+        BenchProducers<Queue>(queue_name, 4, 4, 1024, drain);
+        BenchProducers<Queue>(queue_name, 4, 1, 16, drain);
+    }
+}
+
+void RunBlockQueueBenchmarks()
+{
+    BenchQueue<BlockDeque<uint64_t>>("blockdeque");
+    BenchQueue<MpmcQueue<uint64_t>>("mpmcqueue");
+}
@@ -0,0 +1,130 @@
+//
+// Created by ciaowhen on 2023/5/12.
+//
+
+#include "benchmark.h"
+#include "../buffer/buffer.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+
+static const char *GetModeName(Buffer::BUFFER_MODE mode)
+{
+    switch(mode)
+    {
+        case Buffer::BM_LINEAR:
+            return "linear";
+        case Buffer::BM_CHAINED:
+            return "chained";
+        case Buffer::BM_RING:
+            return "ring";
+        default:
+            return "unknown";
+    }
+}
+
+static void BenchAppendRetrieve(Buffer::BUFFER_MODE mode, size_t msg_size)
+{
+    std::string prefix = std::string("buffer/") + GetModeName(mode) + "/";
+    std::string payload(msg_size, 'x');
+
+    {
+        Buffer buff(1024, mode);
+        RunBatched(prefix + "Append/" + std::to_string(msg_size), 2000000, 64, [&](size_t i)
+        {
+            buff.Append(payload.data(), payload.size());
+            if((i & 1023) == 1023)
+            {
+                buff.Retrieve(buff.GetReadableBytes());
+            }
+        });
+    }
+
+    {
+        Buffer buff(1024, mode);
+        RunBatched(prefix + "Retrieve/" + std::to_string(msg_size), 2000000, 64, [&](size_t)
+        {
+            if(buff.GetReadableBytes() < payload.size())
+            {
+                for(int n = 0; n < 256; ++n)
+                {
+                    buff.Append(payload.data(), payload.size());
+                }
+            }
+
+            buff.Retrieve(payload.size());
+        });
+    }
+
+    {
+        //写入略多于读出, 读写位置不断逼近尾部, 迫使MakeSpace前移或扩容
+        Buffer buff(4096, mode);
+        RunBatched(prefix + "MakeSpace(churn)/" + std::to_string(msg_size), 1000000, 64, [&](size_t)
+        {
+            buff.Append(payload.data(), payload.size());
+            buff.Retrieve(std::min(buff.GetReadableBytes(), payload.size() * 3 / 4 + 1));
+            if(buff.GetReadableBytes() > 64 * 1024)
+            {
+                buff.Retrieve(buff.GetReadableBytes());
+            }
+        });
+    }
+}
+
+static void BenchFdRoundTrip(Buffer::BUFFER_MODE mode, bool use_pipe, size_t msg_size)
+{
+    int fds[2];
+    if(use_pipe ? pipe(fds) < 0 : socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+        perror("pipe/socketpair");
+        return;
+    }
+
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+
+    //fds[1]写, fds[0]读; 单线程交替进行, 每次不超过内核缓冲区
+    Buffer out(1024, mode);
+    Buffer in(1024, mode);
+    std::string payload(msg_size, 'y');
+    std::string name = std::string("buffer/") + GetModeName(mode) + (use_pipe ? "/pipe" : "/socketpair");
+    int error = 0;
+
+    RunBatched(name + "/WriteFd/" + std::to_string(msg_size), 200000, 16, [&](size_t)
+    {
+        out.Append(payload.data(), payload.size());
+        out.WriteFd(fds[1], &error);
+        while(in.ReadFd(fds[0], &error) > 0)
+        {
+            in.Retrieve(in.GetReadableBytes());
+        }
+    });
+
+    RunBatched(name + "/ReadFd/" + std::to_string(msg_size), 200000, 16, [&](size_t)
+    {
+        ssize_t written = write(fds[1], payload.data(), payload.size());
+        (void)written;
+        in.ReadFd(fds[0], &error);
+        in.Retrieve(in.GetReadableBytes());
+    });
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void RunBufferBenchmarks()
+{
+    const Buffer::BUFFER_MODE modes[] = {Buffer::BM_LINEAR, Buffer::BM_CHAINED, Buffer::BM_RING};
+    for(auto mode : modes)
+    {
+        for(size_t msg_size : {16, 256, 4096})
+        {
+            BenchAppendRetrieve(mode, msg_size);
+        }
+
+        for(size_t msg_size : {256, 4096})
+        {
+            BenchFdRoundTrip(mode, false, msg_size);
+            BenchFdRoundTrip(mode, true, msg_size);
+        }
+    }
+}
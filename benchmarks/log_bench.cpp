@@ -0,0 +1,359 @@
+//
+// Created by ciaowhen on 2023/5/22.
+//
+
+#include "benchmark.h"
+#include "../log/log.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+//日志基准: 1~N个线程以固定长度的消息驱动Log, 统计单次调用延迟, 生产端吞吐, 写线程追平所需时间和落盘字节数
+//Log是单例且异步模式在第一次Init时固定, 每个配置fork一个子进程单独跑, 结果经管道交回父进程汇总
+namespace
+{
+    struct LogBenchMode
+    {
+        const char *name;
+        int queue_capacity;                             //0为同步写
+        Log::ASYNC_MODE async_mode;
+        Log::OVERFLOW_POLICY overflow;
+    };
+
+    //*-full为队列很小, 生产者总是撞上队列满的情形
+    const LogBenchMode MODES[] = {
+        {"sync",        0,    Log::AM_BLOCK_DEQUE,   Log::OP_WRITE_THROUGH},
+        {"deque",       8192, Log::AM_BLOCK_DEQUE,   Log::OP_WRITE_THROUGH},
+        {"ring",        8192, Log::AM_RING,          Log::OP_WRITE_THROUGH},
+        {"thread",      8192, Log::AM_THREAD_BUFFER, Log::OP_WRITE_THROUGH},
+        {"mpmc",        8192, Log::AM_MPMC_QUEUE,    Log::OP_WRITE_THROUGH},
+        {"deque-full",  8,    Log::AM_BLOCK_DEQUE,   Log::OP_WRITE_THROUGH},
+        {"mpmc-full",   8,    Log::AM_MPMC_QUEUE,    Log::OP_BLOCK},
+        {"ring-full",   8,    Log::AM_RING,          Log::OP_BLOCK},
+        {"ring-drop",   8,    Log::AM_RING,          Log::OP_DROP_NEWEST},
+    };
+
+    struct LogBenchConfig
+    {
+        int threads;
+        size_t message_size;
+        size_t lines;                                   //所有线程合计
+        bool binary;
+        size_t segment_size;                            //大于0时用mmap输出
+        std::string dir;
+    };
+
+    //子进程经管道交回的结果
+    struct LogBenchSample
+    {
+        double seconds;
+        double p50_ns;
+        double p99_ns;
+        double p999_ns;
+        double max_ns;
+        double catchup_ms;
+        uint64_t written;
+        uint64_t dropped;
+        bool ok;
+    };
+
+    const uint64_t CATCHUP_TIMEOUT_NS = 60ull * 1000000000ull;
+
+    bool IsTmpfs(const std::string &dir)
+    {
+        struct statfs st;
+        return statfs(dir.c_str(), &st) == 0 && st.f_type == 0x01021994;     //TMPFS_MAGIC
+    }
+
+    //返回目录下文件的总字节数, remove为true时顺便删除
+    uint64_t ScanDir(const std::string &dir, bool remove)
+    {
+        uint64_t bytes = 0;
+        DIR *handle = opendir(dir.c_str());
+        if(!handle)
+        {
+            return 0;
+        }
+
+        struct dirent *entry = nullptr;
+        while((entry = readdir(handle)) != nullptr)
+        {
+            std::string path = dir + "/" + entry->d_name;
+            struct stat st;
+            if(entry->d_name[0] == '.' || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            {
+                continue;
+            }
+
+            bytes += static_cast<uint64_t>(st.st_size);
+            if(remove)
+            {
+                unlink(path.c_str());
+            }
+        }
+
+        closedir(handle);
+        return bytes;
+    }
+
+    //在子进程中运行, 写线程追平后把结果写进fd
+    void RunChild(const LogBenchMode &mode, const LogBenchConfig &config, int fd)
+    {
+        Log *log = Log::Instance();
+        log->SetFlushPolicy(Log::FP_NONE);
+        log->SetOverflowPolicy(mode.overflow);
+        if(config.segment_size > 0)
+        {
+            log->SetMmapOutput(config.segment_size, 0);
+        }
+
+        log->Init(Log::LL_INFO, config.dir.c_str(), ".log", mode.queue_capacity, mode.async_mode, config.binary);
+
+        std::string payload(config.message_size, 'x');
+        std::string_view body(payload);
+        size_t per_thread = config.lines / config.threads;
+        std::vector<LatencyRecorder> latencies(config.threads, LatencyRecorder(per_thread));
+        std::vector<std::thread> threads;
+        uint64_t begin = BenchNowNs();
+        for(int t = 0; t < config.threads; ++t)
+        {
+            threads.emplace_back([&, t]
+            {
+                LatencyRecorder &latency = latencies[t];
+                for(size_t i = 0; i < per_thread; ++i)
+                {
+                    uint64_t call_begin = BenchNowNs();
+                    LOG_INFO("{}", body);
+                    latency.Add(BenchNowNs() - call_begin);
+                }
+            });
+        }
+
+        for(auto &thread : threads)
+        {
+            thread.join();
+        }
+
+        uint64_t end = BenchNowNs();
+
+        //生产者全部返回后, 等写线程把剩下的都交给文件
+        Log::OverflowStats stats = log->GetOverflowStats();
+        uint64_t dropped = stats.dropped_newest + stats.dropped_oldest + stats.sampled_out;
+        uint64_t expected = per_thread * config.threads - dropped;
+        bool ok = true;
+        while(log->GetWrittenLines() < expected)
+        {
+            if(BenchNowNs() - end > CATCHUP_TIMEOUT_NS)
+            {
+                ok = false;
+                break;
+            }
+
+            log->Flush();
+            usleep(100);
+        }
+
+        log->Flush();
+        uint64_t caught_up = BenchNowNs();
+
+        LatencyRecorder latency;
+        for(auto &recorder : latencies)
+        {
+            latency.Merge(recorder);
+        }
+
+        LogBenchSample sample;
+        sample.seconds = (end - begin) / 1e9;
+        sample.p50_ns = latency.GetPercentile(50);
+        sample.p99_ns = latency.GetPercentile(99);
+        sample.p999_ns = latency.GetPercentile(99.9);
+        sample.max_ns = latency.GetPercentile(100);
+        sample.catchup_ms = (caught_up - end) / 1e6;
+        sample.written = log->GetWrittenLines();
+        sample.dropped = dropped;
+        sample.ok = ok;
+        ssize_t n = write(fd, &sample, sizeof(sample));
+        (void)n;
+    }
+
+    void RunConfig(const LogBenchMode &mode, const LogBenchConfig &config, const char *dir_label)
+    {
+        std::string name = std::string("log/") + mode.name + (config.binary ? "+binary" : "") + (config.segment_size > 0 ? "+mmap" : "") + "/"
+                           + dir_label + "/threads=" + std::to_string(config.threads) + "/size=" + std::to_string(config.message_size);
+        BenchReporter *reporter = BenchReporter::Instance();
+        if(!reporter->IsEnabled(name))
+        {
+            return;
+        }
+
+        ScanDir(config.dir, true);
+        int fds[2];
+        if(pipe(fds) != 0)
+        {
+            return;
+        }
+
+        fflush(stdout);
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            close(fds[0]);
+            RunChild(mode, config, fds[1]);
+            close(fds[1]);
+            exit(0);                                    //走正常退出, Log析构时关闭文件, mmap文件截断到实际长度
+        }
+
+        close(fds[1]);
+        LogBenchSample sample;
+        bool received = pid > 0 && read(fds[0], &sample, sizeof(sample)) == static_cast<ssize_t>(sizeof(sample));
+        close(fds[0]);
+        if(pid > 0)
+        {
+            waitpid(pid, nullptr, 0);
+        }
+
+        if(!received || !sample.ok)
+        {
+            fprintf(stderr, "%s: %s\n", name.c_str(), received ? "writer did not catch up" : "child failed");
+            ScanDir(config.dir, true);
+            return;
+        }
+
+        uint64_t bytes = ScanDir(config.dir, true);
+        size_t lines = config.lines / config.threads * config.threads;
+
+        BenchResult result;
+        result.name = name;
+        result.ops = lines;
+        result.seconds = sample.seconds;
+        result.ops_per_sec = sample.seconds > 0 ? lines / sample.seconds : 0;
+        result.p50_ns = sample.p50_ns;
+        result.p99_ns = sample.p99_ns;
+        result.metrics.push_back({"p999_ns", sample.p999_ns});
+        result.metrics.push_back({"max_ns", sample.max_ns});
+        result.metrics.push_back({"catchup_ms", sample.catchup_ms});
+        result.metrics.push_back({"e2e_lines_per_sec", lines / (sample.seconds + sample.catchup_ms / 1e3)});
+        result.metrics.push_back({"written", static_cast<double>(sample.written)});
+        result.metrics.push_back({"dropped", static_cast<double>(sample.dropped)});
+        result.metrics.push_back({"bytes", static_cast<double>(bytes)});
+        reporter->Add(result);
+    }
+
+    std::vector<std::string> Split(const std::string &text)
+    {
+        std::vector<std::string> parts;
+        size_t begin = 0;
+        while(begin <= text.size())
+        {
+            size_t end = text.find(',', begin);
+            end = end == std::string::npos ? text.size() : end;
+            if(end > begin)
+            {
+                parts.push_back(text.substr(begin, end - begin));
+            }
+
+            begin = end + 1;
+        }
+
+        return parts;
+    }
+
+    void PrintUsage(const char *program)
+    {
+        printf("usage: %s [--json | --csv] [--filter <substring>] [--scale <factor>]\n"
+               "          [--threads <max>] [--sizes <bytes,...>] [--lines <count>] [--dirs <dir,...>] [--binary] [--mmap <segment bytes>]\n"
+               "  threads run 1, 2, 4, ... up to --threads; each --dirs entry is labelled tmpfs or disk\n", program);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    BenchReporter *reporter = BenchReporter::Instance();
+    int max_threads = static_cast<int>(std::max(4u, std::thread::hardware_concurrency()));
+    std::vector<std::string> sizes = {"64", "256"};
+    std::vector<std::string> dirs = {"/dev/shm/log_bench", "./log_bench"};
+    size_t lines = 200000;
+    bool binary = false;
+    size_t segment_size = 0;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(reporter->ParseOption(argc, argv, i))
+        {
+            continue;
+        }
+
+        if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+        {
+            max_threads = std::max(1, atoi(argv[++i]));
+        }
+        else if(strcmp(argv[i], "--sizes") == 0 && i + 1 < argc)
+        {
+            sizes = Split(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--lines") == 0 && i + 1 < argc)
+        {
+            lines = strtoull(argv[++i], nullptr, 10);
+        }
+        else if(strcmp(argv[i], "--dirs") == 0 && i + 1 < argc)
+        {
+            dirs = Split(argv[++i]);
+        }
+        else if(strcmp(argv[i], "--binary") == 0)
+        {
+            binary = true;
+        }
+        else if(strcmp(argv[i], "--mmap") == 0 && i + 1 < argc)
+        {
+            segment_size = strtoull(argv[++i], nullptr, 10);
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    for(const std::string &dir : dirs)
+    {
+        //父目录不存在(比如没有/dev/shm)时跳过
+        if(mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+        {
+            fprintf(stderr, "skip %s: %s\n", dir.c_str(), strerror(errno));
+            continue;
+        }
+
+        const char *label = IsTmpfs(dir) ? "tmpfs" : "disk";
+        for(const LogBenchMode &mode : MODES)
+        {
+            for(const std::string &size : sizes)
+            {
+                for(int threads = 1; threads <= max_threads; threads = threads < max_threads && threads * 2 > max_threads ? max_threads : threads * 2)
+                {
+                    LogBenchConfig config;
+                    config.threads = threads;
+                    config.message_size = strtoull(size.c_str(), nullptr, 10);
+                    config.lines = std::max(reporter->Scaled(lines), static_cast<size_t>(threads));
+                    config.binary = binary;
+                    config.segment_size = segment_size;
+                    config.dir = dir;
+                    RunConfig(mode, config, label);
+                }
+            }
+        }
+
+        rmdir(dir.c_str());
+    }
+
+    reporter->Finish();
+    return 0;
+}
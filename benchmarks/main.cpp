@@ -0,0 +1,30 @@
+//
+// Created by ciaowhen on 2023/5/12.
+//
+
+#include "benchmark.h"
+#include <cstdio>
+
+static void PrintUsage(const char *program)
+{
+    printf("usage: %s [--json | --csv] [--filter <substring>] [--scale <factor>]\n", program);
+}
+
+int main(int argc, char *argv[])
+{
+    BenchReporter *reporter = BenchReporter::Instance();
+    for(int i = 1; i < argc; ++i)
+    {
+        if(!reporter->ParseOption(argc, argv, i))
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    RunBufferBenchmarks();
+    RunBlockQueueBenchmarks();
+    RunThreadPoolBenchmarks();
+    reporter->Finish();
+    return 0;
+}
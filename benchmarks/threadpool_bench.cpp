@@ -0,0 +1,228 @@
+//
+// Created by ciaowhen on 2023/5/12.
+//
+
+#include "benchmark.h"
+#include "../threadpool/threadpool.h"
+#include <atomic>
+
+//提交N个空任务, 计时到全部执行完毕; 延迟为单次AddTask调用耗时
+static const char *GetModeName(ThreadPool::SCHEDULE_MODE mode)
+{
+    return mode == ThreadPool::SM_WORK_STEALING ? "stealing" : "shared";
+}
+
+static void BenchAddTask(size_t thread_count)
+{
+    std::string name = "threadpool/AddTask/threads=" + std::to_string(thread_count);
+    BenchReporter *reporter = BenchReporter::Instance();
+    if(!reporter->IsEnabled(name))
+    {
+        return;
+    }
+
+    const size_t total = reporter->Scaled(200000);
+    std::atomic<size_t> done(0);
+    LatencyRecorder latency(total);
+    ThreadPool pool(thread_count);
+
+    uint64_t begin = BenchNowNs();
+    for(size_t i = 0; i < total; ++i)
+    {
+        uint64_t submit_begin = BenchNowNs();
+        pool.AddTask([&done]
+        {
+            done.fetch_add(1, std::memory_order_relaxed);
+        });
+        latency.Add(BenchNowNs() - submit_begin);
+    }
+
+    while(done.load(std::memory_order_acquire) < total)
+    {
+        std::this_thread::yield();
+    }
+
+    reporter->Report(name, total, (BenchNowNs() - begin) / 1e9, latency);
+}
+
+//线程池空闲时提交单个任务, 统计从提交到任务开始执行的唤醒延迟
+static void BenchWakeup(size_t thread_count)
+{
+    std::string name = "threadpool/wakeup_latency/threads=" + std::to_string(thread_count);
+    BenchReporter *reporter = BenchReporter::Instance();
+    if(!reporter->IsEnabled(name))
+    {
+        return;
+    }
+
+    const size_t total = reporter->Scaled(2000);
+    LatencyRecorder latency(total);
+    ThreadPool pool(thread_count);
+
+    uint64_t begin = BenchNowNs();
+    for(size_t i = 0; i < total; ++i)
+    {
+        std::atomic<uint64_t> started(0);
+        uint64_t submit = BenchNowNs();
+        pool.AddTask([&started]
+        {
+            started.store(BenchNowNs(), std::memory_order_release);
+        });
+
+        uint64_t start_time = 0;
+        while((start_time = started.load(std::memory_order_acquire)) == 0)
+        {
+            std::this_thread::yield();
+        }
+
+        latency.Add(start_time - submit);
+        //让工作线程重新进入等待状态
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    reporter->Report(name, total, (BenchNowNs() - begin) / 1e9, latency);
+}
+
+//捕获较大状态的任务(超过std::function的内联缓冲), 以及通过Submit取回结果的往返耗时
+static void BenchLargeCapture(size_t thread_count)
+{
+    std::string name = "threadpool/AddTask(96B capture)/threads=" + std::to_string(thread_count);
+    BenchReporter *reporter = BenchReporter::Instance();
+    if(!reporter->IsEnabled(name))
+    {
+        return;
+    }
+
+    const size_t total = reporter->Scaled(200000);
+    std::atomic<size_t> done(0);
+    LatencyRecorder latency(total);
+    ThreadPool pool(thread_count);
+    struct Payload
+    {
+        uint64_t words[12];
+    } payload = {};
+
+    uint64_t begin = BenchNowNs();
+    for(size_t i = 0; i < total; ++i)
+    {
+        payload.words[0] = i;
+        uint64_t submit_begin = BenchNowNs();
+        pool.AddTask([&done, payload]
+        {
+            done.fetch_add(payload.words[0] > 0 ? 1 : 1, std::memory_order_relaxed);
+        });
+        latency.Add(BenchNowNs() - submit_begin);
+    }
+
+    while(done.load(std::memory_order_acquire) < total)
+    {
+        std::this_thread::yield();
+    }
+
+    reporter->Report(name, total, (BenchNowNs() - begin) / 1e9, latency);
+}
+
+static void BenchSubmit(size_t thread_count)
+{
+    std::string name = "threadpool/Submit+Get/threads=" + std::to_string(thread_count);
+    const size_t batch = 64;
+    ThreadPool pool(thread_count);
+    std::vector<TaskFuture<size_t>> futures(batch);
+    RunBatched(name, 200000, batch, [&](size_t i)
+    {
+        futures[i % batch] = pool.Submit([](size_t value){ return value * 2; }, i);
+        if(i % batch == batch - 1)
+        {
+            for(auto &future : futures)
+            {
+                future.Get();
+            }
+        }
+    });
+}
+
+static void SpinFor(uint64_t ns)
+{
+    uint64_t end = BenchNowNs() + ns;
+    while(BenchNowNs() < end)
+    {
+    }
+}
+
+//扩展性测试: 外部提交少量根任务, 每个根任务在工作线程内再派生子任务(fork-join负载)
+//统计单位时间完成的任务数, 延迟为根任务从提交到其全部子任务完成的耗时
+static void BenchScaling(ThreadPool::SCHEDULE_MODE mode, size_t thread_count)
+{
+    std::string name = std::string("threadpool/scaling/") + GetModeName(mode) + "/threads=" + std::to_string(thread_count);
+    BenchReporter *reporter = BenchReporter::Instance();
+    if(!reporter->IsEnabled(name))
+    {
+        return;
+    }
+
+    const size_t children = 64;
+    const size_t roots = std::max(static_cast<size_t>(1), reporter->Scaled(100000) / children);
+    std::atomic<size_t> done(0);
+    std::vector<std::atomic<size_t>> remaining(roots);
+    std::vector<uint64_t> submit_time(roots);
+    LatencyRecorder latency(roots);
+    std::mutex latency_mtx;
+    ThreadPool pool(thread_count, mode);
+
+    uint64_t begin = BenchNowNs();
+    for(size_t r = 0; r < roots; ++r)
+    {
+        remaining[r] = children;
+        submit_time[r] = BenchNowNs();
+        pool.AddTask([&, r]
+        {
+            for(size_t c = 0; c < children; ++c)
+            {
+                pool.AddTask([&, r]
+                {
+                    SpinFor(200);
+                    if(remaining[r].fetch_sub(1) == 1)
+                    {
+                        std::lock_guard<std::mutex> locker(latency_mtx);
+                        latency.Add(BenchNowNs() - submit_time[r]);
+                    }
+
+                    done.fetch_add(1, std::memory_order_release);
+                });
+            }
+
+            done.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    const size_t total = roots * (children + 1);
+    while(done.load(std::memory_order_acquire) < total)
+    {
+        std::this_thread::yield();
+    }
+
+    reporter->Report(name, total, (BenchNowNs() - begin) / 1e9, latency);
+}
+
+void RunThreadPoolBenchmarks()
+{
+    for(size_t thread_count : {1, 2, 4, 8})
+    {
+        BenchAddTask(thread_count);
+    }
+
+    for(size_t thread_count : {1, 4})
+    {
+        BenchWakeup(thread_count);
+        BenchLargeCapture(thread_count);
+        BenchSubmit(thread_count);
+    }
+
+    for(auto mode : {ThreadPool::SM_SHARED_QUEUE, ThreadPool::SM_WORK_STEALING})
+    {
+        for(size_t thread_count : {1, 2, 4, 8, 16, 32, 64})
+        {
+            BenchScaling(mode, thread_count);
+        }
+    }
+}
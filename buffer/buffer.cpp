@@ -3,19 +3,48 @@
 //
 
 #include "buffer.h"
+#include "bufferpool.h"
+#include "buffersearch.h"
 #include <cassert>
 #include <cstring>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/mman.h>
 
-Buffer::Buffer(int max_buff_size): m_buffer(max_buff_size), m_read_pos(0)
+Buffer::Buffer(int max_buff_size, BUFFER_MODE mode): m_mode(mode), m_buffer(nullptr), m_capacity(0), m_read_pos(0), m_write_pos(0), m_block_size(max_buff_size), m_chain_bytes(0), m_file_bytes(0)
 {
+    assert(max_buff_size > 0);
+    if(m_mode == BM_RING && !RingMap(max_buff_size))
+    {
+        //memfd/mmap不可用时退化为线性模式
+        m_mode = BM_LINEAR;
+    }
 
+    if(m_mode == BM_LINEAR)
+    {
+        m_buffer = BufferPool::Instance()->Allocate(max_buff_size, &m_capacity);
+    }
+}
+
+Buffer::~Buffer()
+{
+    Clear();
+    if(m_mode == BM_RING)
+    {
+        RingUnmap();
+    }
 }
 
 void Buffer::Append(const char *data, size_t len)
 {
-    if(!data)
+    if(!data || len == 0)
+    {
+        return;
+    }
+
+    if(m_mode == BM_CHAINED)
     {
+        ChainAppend(data, len);
         return;
     }
 
@@ -36,13 +65,40 @@ void Buffer::Append(const std::string data, size_t len)
 
 void Buffer::Append(const Buffer &buff)
 {
+    if(buff.m_mode == BM_CHAINED)
+    {
+        //文件段没有内存数据, 只复制字节块
+        for(const auto &block : buff.m_blocks)
+        {
+            if(!block.data)
+            {
+                continue;
+            }
+
+            Append(block.data + block.read_pos, block.write_pos - block.read_pos);
+        }
+
+        return;
+    }
+
     Append(buff.GetCurrReadPos(), buff.GetReadableBytes());
 }
 
 void Buffer::Retrieve(size_t len)
 {
     assert(len <= GetReadableBytes());
+    if(m_mode == BM_CHAINED)
+    {
+        ChainRetrieve(len);
+        return;
+    }
+
     m_read_pos += len;
+    if(m_mode == BM_RING && m_read_pos >= m_capacity)
+    {
+        m_read_pos -= m_capacity;
+        m_write_pos -= m_capacity;
+    }
 }
 
 void Buffer::RetrieveUntil(const char *end)
@@ -53,23 +109,64 @@ void Buffer::RetrieveUntil(const char *end)
 
 std::string Buffer::RetrieveToStr()
 {
-    std::string str(GetCurrReadPos(), GetReadableBytes());
+    std::string str;
+    if(m_mode == BM_CHAINED)
+    {
+        //只取字节块, 文件段在Clear时丢弃
+        str.reserve(m_chain_bytes);
+        for(const auto &block : m_blocks)
+        {
+            if(!block.data)
+            {
+                continue;
+            }
+
+            str.append(block.data + block.read_pos, block.write_pos - block.read_pos);
+        }
+    }
+    else
+    {
+        str.assign(GetCurrReadPos(), GetReadableBytes());
+    }
+
     Clear();
     return str;
 }
 
 char * Buffer::GetBeginWritePos()
 {
+    if(m_mode == BM_CHAINED)
+    {
+        return m_blocks.empty() || !m_blocks.back().data ? nullptr : m_blocks.back().data + m_blocks.back().write_pos;
+    }
+
     return GetBeginPtr() + m_write_pos;
 }
 
 const char * Buffer::GetBeginWritePosConst() const
 {
+    if(m_mode == BM_CHAINED)
+    {
+        return m_blocks.empty() || !m_blocks.back().data ? nullptr : m_blocks.back().data + m_blocks.back().write_pos;
+    }
+
     return GetBeginPtrConst() + m_write_pos;
 }
 
 const char * Buffer::GetCurrReadPos() const
 {
+    if(m_mode == BM_CHAINED)
+    {
+        //含文件段的链没有连续视图
+        if(m_blocks.empty() || m_file_bytes > 0)
+        {
+            return nullptr;
+        }
+
+        Linearize();
+        return m_blocks.front().data + m_blocks.front().read_pos;
+    }
+
     return GetBeginPtrConst() + m_read_pos;
 }
 
@@ -78,7 +175,18 @@ void Buffer::SetEnsureWritable(size_t len)
     assert(len > 0);
     if(GetWritableBytes() < len)
     {
-        MakeSpace(len - GetWritableBytes());
+        if(m_mode == BM_CHAINED)
+        {
+            LinkBlock(len);
+        }
+        else if(m_mode == BM_RING)
+        {
+            RingGrow(GetReadableBytes() + len);
+        }
+        else
+        {
+            MakeSpace(len);
+        }
     }
 
     assert(GetWritableBytes() >= len);
@@ -86,33 +194,118 @@ void Buffer::SetEnsureWritable(size_t len)
 
 void Buffer::RefreshWritePos(size_t len)
 {
-    assert(len < 0);
+    assert(len <= GetWritableBytes());
+    if(m_mode == BM_CHAINED)
+    {
+        if(len > 0)
+        {
+            m_blocks.back().write_pos += len;
+            m_chain_bytes += len;
+        }
+
+        return;
+    }
+
     m_write_pos += len;
 }
 
 size_t Buffer::GetWritableBytes() const
 {
-    return m_buffer.size() - m_write_pos;
+    if(m_mode == BM_CHAINED)
+    {
+        return m_blocks.empty() || !m_blocks.back().data ? 0 : m_blocks.back().capacity - m_blocks.back().write_pos;
+    }
+
+    if(m_mode == BM_RING)
+    {
+        return m_capacity - GetReadableBytes();
+    }
+
+    return m_capacity - m_write_pos;
 }
 
 size_t Buffer::GetReadableBytes() const
 {
+    if(m_mode == BM_CHAINED)
+    {
+        return m_chain_bytes;
+    }
+
     return m_write_pos - m_read_pos;
 }
 
 size_t Buffer::GetPreParedableBytes() const
 {
+    if(m_mode == BM_CHAINED)
+    {
+        return m_blocks.empty() || !m_blocks.front().data ? 0 : m_blocks.front().read_pos;
+    }
+
+    if(m_mode == BM_RING)
+    {
+        return 0;
+    }
+
     return m_read_pos;
 }
 
+const char* Buffer::FindCRLF() const
+{
+    const char *begin = GetCurrReadPos();
+    return begin ? BufferSearch::FindCRLF(begin, begin + GetReadableBytes()) : nullptr;
+}
+
+const char* Buffer::FindDoubleCRLF() const
+{
+    const char *begin = GetCurrReadPos();
+    return begin ? BufferSearch::FindDoubleCRLF(begin, begin + GetReadableBytes()) : nullptr;
+}
+
+const char* Buffer::FindByte(char c) const
+{
+    const char *begin = GetCurrReadPos();
+    return begin ? BufferSearch::FindByte(begin, begin + GetReadableBytes(), c) : nullptr;
+}
+
+const char* Buffer::FindAnyOf(const char *chars, size_t count) const
+{
+    const char *begin = GetCurrReadPos();
+    return begin ? BufferSearch::FindAnyOf(begin, begin + GetReadableBytes(), chars, count) : nullptr;
+}
+
 ssize_t Buffer::ReadFd(int fd, int *error)
 {
+    if(m_mode == BM_RING)
+    {
+        //可写区总是连续的, 直接读入, 满了才扩容
+        if(GetWritableBytes() == 0)
+        {
+            RingGrow(m_capacity * 2);
+        }
+
+        const ssize_t len = read(fd, GetBeginWritePos(), GetWritableBytes());
+        if(len < 0)
+        {
+            *error = errno;
+            return len;
+        }
+
+        RefreshWritePos(len);
+        return len;
+    }
+
+    //链式模式尾块已满, 或线性模式存储已在Clear时归还, 先取一块再读, 省去栈缓冲的二次拷贝
+    if(GetWritableBytes() == 0 && (m_mode == BM_CHAINED || !m_buffer))
+    {
+        SetEnsureWritable(m_block_size);
+    }
+
     char buff[MAX_BUFFER_SIZE];
     const size_t writable = GetWritableBytes();
     struct iovec iov[IS_COUNT];
 
-    iov[0].iov_base = GetBeginPtr() + m_write_pos;
-    iov[0].iov_len = GetWritableBytes();
+    iov[0].iov_base = GetBeginWritePos();
+    iov[0].iov_len = writable;
     iov[1].iov_base = buff;
     iov[1].iov_len = sizeof(buff);
 
@@ -127,7 +320,7 @@ ssize_t Buffer::ReadFd(int fd, int *error)
     }
     else
     {
-        m_write_pos = m_buffer.size();
+        RefreshWritePos(writable);
         Append(buff, len - writable);
     }
 
@@ -136,11 +329,17 @@ ssize_t Buffer::ReadFd(int fd, int *error)
 
 ssize_t Buffer::WriteFd(int fd, int *error)
 {
+    if(m_mode == BM_CHAINED)
+    {
+        return ChainWriteFd(fd, error);
+    }
+
     size_t read_size = GetReadableBytes();
     ssize_t len = write(fd, GetCurrReadPos(), read_size);
     if(len < 0)
     {
         *error = errno;
+        return len;
     }
 
     Retrieve(len);
@@ -149,38 +348,381 @@ ssize_t Buffer::WriteFd(int fd, int *error)
 
 void Buffer::Clear()
 {
-    bzero(&m_buffer[0], m_buffer.size());
+    if(m_mode == BM_CHAINED)
+    {
+        for(auto &block : m_blocks)
+        {
+            ReleaseBlock(block);
+        }
+
+        m_blocks.clear();
+        m_chain_bytes = 0;
+        m_file_bytes = 0;
+        return;
+    }
+
+    if(m_mode == BM_RING)
+    {
+        m_write_pos = 0;
+        m_read_pos = 0;
+        return;
+    }
+
+    BufferPool::Instance()->Deallocate(m_buffer, m_capacity);
+    m_buffer = nullptr;
+    m_capacity = 0;
     m_write_pos = 0;
     m_read_pos = 0;
 }
 
+size_t Buffer::GetBlockCount() const
+{
+    return m_mode == BM_CHAINED ? m_blocks.size() : 1;
+}
+
 char* Buffer::GetBeginPtr()
 {
-    return &*m_buffer.begin();
+    return m_buffer;
 }
 
 const char* Buffer::GetBeginPtrConst() const
 {
-    return &*m_buffer.begin();
+    return m_buffer;
 }
 
 void Buffer::MakeSpace(size_t make_size)
 {
+    size_t read_able_size = GetReadableBytes();
     if(GetWritableBytes() + GetPreParedableBytes() < make_size)
     {
-        m_buffer.resize(m_write_pos + make_size);
+        //换一个更大分级的块, 只搬运未读数据
+        size_t new_capacity = 0;
+        char *new_buffer = BufferPool::Instance()->Allocate(read_able_size + make_size, &new_capacity);
+        std::copy(GetBeginPtr() + m_read_pos, GetBeginPtr() + m_write_pos, new_buffer);
+        BufferPool::Instance()->Deallocate(m_buffer, m_capacity);
+        m_buffer = new_buffer;
+        m_capacity = new_capacity;
     }
     else
     {
-        size_t read_able_size = GetReadableBytes();
         std::copy(GetBeginPtr() + m_read_pos, GetBeginPtr() + m_write_pos, GetBeginPtr());
-        m_read_pos = 0;
-        m_write_pos = m_read_pos + read_able_size;
-        assert(read_able_size == GetReadableBytes());
     }
 
+    m_read_pos = 0;
+    m_write_pos = read_able_size;
+    assert(read_able_size == GetReadableBytes());
 }
 
+Buffer::BufferBlock& Buffer::LinkBlock(size_t min_size)
+{
+    //尾块为空时直接替换, 避免链上残留空块
+    if(!m_blocks.empty() && m_blocks.back().data && m_blocks.back().read_pos == m_blocks.back().write_pos)
+    {
+        ReleaseBlock(m_blocks.back());
+        m_blocks.pop_back();
+    }
 
+    BufferBlock block;
+    block.data = BufferPool::Instance()->Allocate(std::max(m_block_size, min_size), &block.capacity);
+    block.read_pos = 0;
+    block.write_pos = 0;
+    block.file_fd = -1;
+    block.file_offset = 0;
+    block.owns_fd = false;
+    m_blocks.push_back(block);
+    return m_blocks.back();
+}
 
+void Buffer::ReleaseBlock(BufferBlock &block)
+{
+    if(!block.data)
+    {
+        if(block.owns_fd && block.file_fd >= 0)
+        {
+            close(block.file_fd);
+        }
 
+        block.file_fd = -1;
+        return;
+    }
+
+    BufferPool::Instance()->Deallocate(block.data, block.capacity);
+    block.data = nullptr;
+}
+
+void Buffer::Linearize() const
+{
+    //文件段只能由WriteFd发送, 不能合并进连续视图
+    if(m_blocks.size() <= 1 || m_file_bytes > 0)
+    {
+        return;
+    }
+
+    //仅在调用方需要连续视图时才合并, 追加/写出路径不会触发; 合并后保留尾块原有的可写空间
+    BufferBlock merged;
+    merged.data = BufferPool::Instance()->Allocate(std::max(m_block_size, m_chain_bytes + GetWritableBytes()), &merged.capacity);
+    merged.read_pos = 0;
+    merged.write_pos = 0;
+    merged.file_fd = -1;
+    merged.file_offset = 0;
+    merged.owns_fd = false;
+
+    for(auto &block : m_blocks)
+    {
+        std::copy(block.data + block.read_pos, block.data + block.write_pos, merged.data + merged.write_pos);
+        merged.write_pos += block.write_pos - block.read_pos;
+        BufferPool::Instance()->Deallocate(block.data, block.capacity);
+    }
+
+    m_blocks.clear();
+    m_blocks.push_back(merged);
+}
+
+void Buffer::ChainAppend(const char *data, size_t len)
+{
+    while(len > 0)
+    {
+        if(GetWritableBytes() == 0)
+        {
+            LinkBlock(m_block_size);
+        }
+
+        BufferBlock &tail = m_blocks.back();
+        size_t copy_size = std::min(len, tail.capacity - tail.write_pos);
+        std::copy(data, data + copy_size, tail.data + tail.write_pos);
+        tail.write_pos += copy_size;
+        m_chain_bytes += copy_size;
+        data += copy_size;
+        len -= copy_size;
+    }
+}
+
+void Buffer::ChainRetrieve(size_t len)
+{
+    while(len > 0 && !m_blocks.empty())
+    {
+        BufferBlock &head = m_blocks.front();
+        size_t block_readable = head.write_pos - head.read_pos;
+        size_t &counter = head.data ? m_chain_bytes : m_file_bytes;
+        if(len < block_readable)
+        {
+            head.read_pos += len;
+            counter -= len;
+            return;
+        }
+
+        len -= block_readable;
+        counter -= block_readable;
+        if(m_blocks.size() == 1 && head.data)
+        {
+            //保留最后一块复用, 避免反复申请
+            head.read_pos = 0;
+            head.write_pos = 0;
+            return;
+        }
+
+        ReleaseBlock(head);
+        m_blocks.pop_front();
+    }
+}
+
+ssize_t Buffer::ChainWriteFd(int fd, int *error)
+{
+    //字节段用writev, 文件段用sendfile, 交替推进直到发完或内核缓冲区写满
+    ssize_t total = 0;
+    while(GetPendingBytes() > 0)
+    {
+        while(m_blocks.front().data && m_blocks.front().read_pos == m_blocks.front().write_pos)
+        {
+            ReleaseBlock(m_blocks.front());
+            m_blocks.pop_front();
+        }
+
+        size_t expect = 0;
+        ssize_t len = m_blocks.front().data ? ChainWriteBytes(fd, error, &expect) : ChainSendFile(fd, error, &expect);
+        if(len < 0)
+        {
+            return total > 0 ? total : len;
+        }
+
+        total += len;
+        if(static_cast<size_t>(len) < expect)
+        {
+            break;
+        }
+    }
+
+    return total;
+}
+
+ssize_t Buffer::ChainWriteBytes(int fd, int *error, size_t *expect)
+{
+    struct iovec iov[MAX_WRITEV_BLOCKS];
+    int iov_count = 0;
+    for(auto it = m_blocks.begin(); it != m_blocks.end() && it->data && iov_count < MAX_WRITEV_BLOCKS; ++it)
+    {
+        if(it->write_pos == it->read_pos)
+        {
+            continue;
+        }
+
+        iov[iov_count].iov_base = it->data + it->read_pos;
+        iov[iov_count].iov_len = it->write_pos - it->read_pos;
+        *expect += iov[iov_count].iov_len;
+        ++iov_count;
+    }
+
+    ssize_t len = writev(fd, iov, iov_count);
+    if(len < 0)
+    {
+        *error = errno;
+        return len;
+    }
+
+    ChainRetrieve(len);
+    return len;
+}
+
+ssize_t Buffer::ChainSendFile(int fd, int *error, size_t *expect)
+{
+    BufferBlock &head = m_blocks.front();
+    off_t offset = head.file_offset + head.read_pos;
+    *expect = head.write_pos - head.read_pos;
+    ssize_t len = sendfile(fd, head.file_fd, &offset, *expect);
+    if(len < 0)
+    {
+        *error = errno;
+        return len;
+    }
+
+    if(len == 0)
+    {
+        //文件比登记的长度短, 对端收到的数据已不完整; 保留该段, 之后的发送都报同样的错误
+        *error = EIO;
+        return -1;
+    }
+
+    ChainRetrieve(len);
+    return len;
+}
+
+void Buffer::AppendFile(int file_fd, off_t offset, size_t len, bool owns_fd)
+{
+    assert(m_mode == BM_CHAINED);
+    assert(file_fd >= 0);
+    if(len == 0)
+    {
+        if(owns_fd)
+        {
+            close(file_fd);
+        }
+
+        return;
+    }
+
+    if(!m_blocks.empty() && m_blocks.back().data && m_blocks.back().read_pos == m_blocks.back().write_pos)
+    {
+        ReleaseBlock(m_blocks.back());
+        m_blocks.pop_back();
+    }
+
+    BufferBlock block;
+    block.data = nullptr;
+    block.capacity = 0;
+    block.read_pos = 0;
+    block.write_pos = len;
+    block.file_fd = file_fd;
+    block.file_offset = offset;
+    block.owns_fd = owns_fd;
+    m_blocks.push_back(block);
+    m_file_bytes += len;
+}
+
+size_t Buffer::GetFileBytes() const
+{
+    return m_file_bytes;
+}
+
+size_t Buffer::GetPendingBytes() const
+{
+    return GetReadableBytes() + m_file_bytes;
+}
+
+bool Buffer::RingMap(size_t capacity)
+{
+    const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    capacity = (capacity + page_size - 1) / page_size * page_size;
+
+    int memfd = memfd_create("buffer_ring", MFD_CLOEXEC);
+    if(memfd < 0)
+    {
+        return false;
+    }
+
+    if(ftruncate(memfd, capacity) < 0)
+    {
+        close(memfd);
+        return false;
+    }
+
+    //先占住2倍大小的地址空间, 再把同一个memfd固定映射到前后两半
+    void *base = mmap(nullptr, capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED)
+    {
+        close(memfd);
+        return false;
+    }
+
+    char *first = static_cast<char *>(base);
+    if(mmap(first, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memfd, 0) == MAP_FAILED
+       || mmap(first + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, memfd, 0) == MAP_FAILED)
+    {
+        munmap(base, capacity * 2);
+        close(memfd);
+        return false;
+    }
+
+    close(memfd);
+    m_buffer = first;
+    m_capacity = capacity;
+    m_read_pos = 0;
+    m_write_pos = 0;
+    return true;
+}
+
+void Buffer::RingUnmap()
+{
+    if(m_buffer)
+    {
+        munmap(m_buffer, m_capacity * 2);
+    }
+
+    m_buffer = nullptr;
+    m_capacity = 0;
+}
+
+void Buffer::RingGrow(size_t min_capacity)
+{
+    size_t new_capacity = std::max(m_capacity, static_cast<size_t>(1));
+    while(new_capacity < min_capacity)
+    {
+        new_capacity *= 2;
+    }
+
+    char *old_buffer = m_buffer;
+    size_t old_capacity = m_capacity;
+    size_t read_pos = m_read_pos;
+    size_t read_able_size = GetReadableBytes();
+
+    if(!RingMap(new_capacity))
+    {
+        //重新映射失败(memfd/地址空间不足)时退化为线性模式, 保证调用方拿到足够的可写空间
+        m_buffer = BufferPool::Instance()->Allocate(new_capacity, &m_capacity);
+        m_mode = BM_LINEAR;
+        m_read_pos = 0;
+    }
+
+    std::copy(old_buffer + read_pos, old_buffer + read_pos + read_able_size, m_buffer);
+    m_write_pos = read_able_size;
+    munmap(old_buffer, old_capacity * 2);
+}
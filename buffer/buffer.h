@@ -7,10 +7,12 @@
 
 #include <string>
 #include <unistd.h>
-#include <vector>
+#include <sys/types.h>
+#include <deque>
 #include <atomic>
 
 #define MAX_BUFFER_SIZE 65535
+#define MAX_WRITEV_BLOCKS 64
 
 class Buffer
 {
@@ -22,8 +24,15 @@ public:
         IS_COUNT,
     };
 
-    Buffer(int max_buff_size = 1024);
-    ~Buffer() = default;
+    enum BUFFER_MODE
+    {
+        BM_LINEAR = 0,                                  //单块连续内存, 空间不足时扩容或前移
+        BM_CHAINED,                                     //固定大小块链表, 空间不足时追加新块
+        BM_RING,                                        //同一组memfd页映射两次的环形缓冲, 可读/可写区总是连续
+    };
+
+    Buffer(int max_buff_size = 1024, BUFFER_MODE mode = BM_LINEAR);
+    ~Buffer();
 
     void Append(const char* data, size_t len);          //向缓冲区写入数据
     void Append(const std::string data, size_t len);
@@ -44,19 +53,70 @@ public:
     size_t GetReadableBytes() const;
     size_t GetPreParedableBytes() const;                 //已读多少字节
 
+    //在可读区内查找分隔符, 返回指向命中位置的指针, 未找到返回nullptr
+    //链式模式下会先合并为连续视图, 返回值可直接交给RetrieveUntil
+    const char* FindCRLF() const;
+    const char* FindDoubleCRLF() const;
+    const char* FindByte(char c) const;
+    const char* FindAnyOf(const char *chars, size_t count) const;
+
     ssize_t ReadFd(int fd, int *error);                 //读取文件
     ssize_t WriteFd(int fd, int *error);                //写入文件
 
-    void Clear();
+    //链式模式: 在字节数据之间排入一段文件, WriteFd时用sendfile发送, 不经过用户态
+    //owns_fd为true时文件段发送完毕或被Clear后由Buffer关闭fd
+    void AppendFile(int file_fd, off_t offset, size_t len, bool owns_fd = false);
+    size_t GetFileBytes() const;                        //尚未发送的文件段字节数
+    size_t GetPendingBytes() const;                     //可读字节数 + 文件段字节数
+
+    void Clear();                                       //存储归还给BufferPool, 不清零; 环形模式只重置读写位置
+    BUFFER_MODE GetMode() const { return m_mode; }
+    size_t GetBlockCount() const;                       //链式模式下当前块数
 
 private:
+    struct BufferBlock
+    {
+        char *data;                                     //文件段为nullptr
+        size_t capacity;
+        size_t read_pos;                                //文件段: 已发送字节数
+        size_t write_pos;                               //文件段: 段长度
+        int file_fd;
+        off_t file_offset;
+        bool owns_fd;
+    };
+
     char *GetBeginPtr();
     const char* GetBeginPtrConst() const;
     void MakeSpace(size_t make_size);
 
-    std::vector<char> m_buffer;
+    //链式模式: 读位置总是指向首块, 写位置总是指向尾块
+    //GetCurrReadPos等连续视图接口在多块时才会把链表合并为一块
+    //链上有文件段时没有连续视图, GetCurrReadPos返回nullptr
+    BufferBlock &LinkBlock(size_t min_size);
+    void ReleaseBlock(BufferBlock &block);
+    void Linearize() const;
+    void ChainAppend(const char *data, size_t len);
+    void ChainRetrieve(size_t len);
+    ssize_t ChainWriteFd(int fd, int *error);
+    ssize_t ChainWriteBytes(int fd, int *error, size_t *expect);
+    ssize_t ChainSendFile(int fd, int *error, size_t *expect);
+
+    //环形模式: [m_buffer, m_buffer + 2 * m_capacity)映射同一段内存两次
+    //m_read_pos始终小于m_capacity, 越界后读写位置一起回绕
+    bool RingMap(size_t capacity);
+    void RingUnmap();
+    void RingGrow(size_t min_capacity);                 //重新映射失败时退化为线性模式
+
+    BUFFER_MODE m_mode;
+    char *m_buffer;                                     //线性模式存储来自BufferPool, 环形模式为双重映射的起始地址
+    size_t m_capacity;
     std::atomic<std::size_t> m_read_pos;
     std::atomic<std::size_t> m_write_pos;
+
+    size_t m_block_size;
+    size_t m_chain_bytes;                               //链上可读字节数(不含文件段)
+    size_t m_file_bytes;                                //链上未发送的文件段字节数
+    mutable std::deque<BufferBlock> m_blocks;
 };
 
 
@@ -0,0 +1,162 @@
+//
+// Created by ciaowhen on 2023/5/9.
+//
+
+#include "bufferpool.h"
+#include <cassert>
+#include <cstdlib>
+
+//线程缓存析构后(如静态对象在主线程退出阶段析构)不能再访问, 之后的分配/回收直接走malloc/free
+static thread_local bool t_cache_destroyed = false;
+
+struct BufferPool::ThreadCache
+{
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    FreeNode *free_list[SC_COUNT] = {nullptr};
+    size_t cached_bytes[SC_COUNT] = {0};
+
+    ~ThreadCache()
+    {
+        //线程退出时把缓存还给系统
+        BufferPool *pool = BufferPool::Instance();
+        for(int i = 0; i < SC_COUNT; ++i)
+        {
+            while(free_list[i])
+            {
+                FreeNode *node = free_list[i];
+                free_list[i] = node->next;
+                free(node);
+            }
+
+            pool->m_cached_bytes -= cached_bytes[i];
+            pool->m_resident_bytes -= cached_bytes[i];
+            cached_bytes[i] = 0;
+        }
+
+        t_cache_destroyed = true;
+    }
+};
+
+BufferPool::BufferPool():m_hits(0), m_misses(0), m_resident_bytes(0), m_cached_bytes(0), m_oversize_allocs(0), m_max_cached_bytes(1 << 20)
+{
+
+}
+
+BufferPool* BufferPool::Instance()
+{
+    static BufferPool buffer_pool;
+    return &buffer_pool;
+}
+
+BufferPool::ThreadCache* BufferPool::GetThreadCache()
+{
+    if(t_cache_destroyed)
+    {
+        return nullptr;
+    }
+
+    thread_local ThreadCache thread_cache;
+    return &thread_cache;
+}
+
+size_t BufferPool::GetClassSize(int size_class)
+{
+    assert(size_class >= 0 && size_class < SC_COUNT);
+    return MIN_CLASS_SIZE << size_class;
+}
+
+int BufferPool::GetSizeClass(size_t size)
+{
+    int size_class = 0;
+    size_t class_size = MIN_CLASS_SIZE;
+    while(class_size < size)
+    {
+        class_size <<= 1;
+        if(++size_class >= SC_COUNT)
+        {
+            return -1;
+        }
+    }
+
+    return size_class;
+}
+
+char* BufferPool::Allocate(size_t size, size_t *real_size)
+{
+    assert(real_size);
+    int size_class = GetSizeClass(size);
+    if(size_class < 0)
+    {
+        m_oversize_allocs.fetch_add(1, std::memory_order_relaxed);
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        m_resident_bytes.fetch_add(size, std::memory_order_relaxed);
+        *real_size = size;
+        return static_cast<char *>(malloc(size));
+    }
+
+    *real_size = GetClassSize(size_class);
+    ThreadCache *cache = GetThreadCache();
+    ThreadCache::FreeNode *node = cache ? cache->free_list[size_class] : nullptr;
+    if(node)
+    {
+        cache->free_list[size_class] = node->next;
+        cache->cached_bytes[size_class] -= *real_size;
+        m_cached_bytes.fetch_sub(*real_size, std::memory_order_relaxed);
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        return reinterpret_cast<char *>(node);
+    }
+
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    m_resident_bytes.fetch_add(*real_size, std::memory_order_relaxed);
+    return static_cast<char *>(malloc(*real_size));
+}
+
+void BufferPool::Deallocate(char *ptr, size_t real_size)
+{
+    if(!ptr)
+    {
+        return;
+    }
+
+    int size_class = GetSizeClass(real_size);
+    ThreadCache *cache = GetThreadCache();
+    if(!cache || size_class < 0 || GetClassSize(size_class) != real_size
+       || cache->cached_bytes[size_class] + real_size > m_max_cached_bytes.load(std::memory_order_relaxed))
+    {
+        m_resident_bytes.fetch_sub(real_size, std::memory_order_relaxed);
+        free(ptr);
+        return;
+    }
+
+    //块头直接复用为链表节点, 不做清零
+    auto node = reinterpret_cast<ThreadCache::FreeNode *>(ptr);
+    node->next = cache->free_list[size_class];
+    cache->free_list[size_class] = node;
+    cache->cached_bytes[size_class] += real_size;
+    m_cached_bytes.fetch_add(real_size, std::memory_order_relaxed);
+}
+
+BufferPool::PoolStats BufferPool::GetStats() const
+{
+    PoolStats stats;
+    stats.hits = m_hits.load(std::memory_order_relaxed);
+    stats.misses = m_misses.load(std::memory_order_relaxed);
+    stats.resident_bytes = m_resident_bytes.load(std::memory_order_relaxed);
+    stats.cached_bytes = m_cached_bytes.load(std::memory_order_relaxed);
+    stats.oversize_allocs = m_oversize_allocs.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void BufferPool::SetMaxCachedBytes(size_t max_bytes)
+{
+    m_max_cached_bytes = max_bytes;
+}
+
+size_t BufferPool::GetMaxCachedBytes() const
+{
+    return m_max_cached_bytes;
+}
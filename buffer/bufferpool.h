@@ -0,0 +1,66 @@
+//
+// Created by ciaowhen on 2023/5/9.
+//
+
+#ifndef ADVANCECODE_BUFFERPOOL_H
+#define ADVANCECODE_BUFFERPOOL_H
+
+#include <atomic>
+#include <cstddef>
+
+//Buffer的存储分配器: 按大小分级, 每个线程维护自己的空闲链表, 回收时不清零
+class BufferPool
+{
+public:
+    enum SIZE_CLASS
+    {
+        SC_1K = 0,
+        SC_2K,
+        SC_4K,
+        SC_8K,
+        SC_16K,
+        SC_32K,
+        SC_64K,
+        SC_COUNT,
+    };
+
+    struct PoolStats
+    {
+        size_t hits;                                    //从线程空闲链表直接取得
+        size_t misses;                                  //需要向系统申请
+        size_t resident_bytes;                          //当前由池持有的总字节数(使用中+缓存中)
+        size_t cached_bytes;                            //空闲链表中缓存的字节数
+        size_t oversize_allocs;                         //超过最大分级, 直接走malloc
+    };
+
+    static BufferPool *Instance();
+
+    char *Allocate(size_t size, size_t *real_size);     //real_size返回实际分到的块大小
+    void Deallocate(char *ptr, size_t real_size);
+
+    PoolStats GetStats() const;
+    void SetMaxCachedBytes(size_t max_bytes);           //单线程单个分级允许缓存的上限
+    size_t GetMaxCachedBytes() const;
+
+    static size_t GetClassSize(int size_class);
+
+private:
+    BufferPool();
+    ~BufferPool() = default;
+
+    static int GetSizeClass(size_t size);
+
+    struct ThreadCache;
+    static ThreadCache *GetThreadCache();
+
+    static const size_t MIN_CLASS_SIZE = 1024;
+
+    std::atomic<size_t> m_hits;
+    std::atomic<size_t> m_misses;
+    std::atomic<size_t> m_resident_bytes;
+    std::atomic<size_t> m_cached_bytes;
+    std::atomic<size_t> m_oversize_allocs;
+    std::atomic<size_t> m_max_cached_bytes;
+};
+
+#endif //ADVANCECODE_BUFFERPOOL_H
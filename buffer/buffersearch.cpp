@@ -0,0 +1,365 @@
+//
+// Created by ciaowhen on 2023/5/10.
+//
+
+#include "buffersearch.h"
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BUFFER_SEARCH_X86 1
+#endif
+
+namespace
+{
+    struct SearchKernels
+    {
+        const char *(*find_byte)(const char *, const char *, char);
+        const char *(*find_any_of)(const char *, const char *, const char *, size_t);
+        const char *(*find_crlf)(const char *, const char *);
+        const char *(*find_double_crlf)(const char *, const char *);
+    };
+
+    //---------------- 标量实现 ----------------
+
+    const char *ScalarFindByte(const char *begin, const char *end, char c)
+    {
+        for(const char *p = begin; p < end; ++p)
+        {
+            if(*p == c)
+            {
+                return p;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const char *ScalarFindAnyOf(const char *begin, const char *end, const char *chars, size_t count)
+    {
+        bool table[256] = {false};
+        for(size_t i = 0; i < count; ++i)
+        {
+            table[static_cast<unsigned char>(chars[i])] = true;
+        }
+
+        for(const char *p = begin; p < end; ++p)
+        {
+            if(table[static_cast<unsigned char>(*p)])
+            {
+                return p;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const char *ScalarFindCRLF(const char *begin, const char *end)
+    {
+        for(const char *p = begin; p + 1 < end; ++p)
+        {
+            if(p[0] == '\r' && p[1] == '\n')
+            {
+                return p;
+            }
+        }
+
+        return nullptr;
+    }
+
+    const char *ScalarFindDoubleCRLF(const char *begin, const char *end)
+    {
+        for(const char *p = begin; p + 3 < end; ++p)
+        {
+            if(p[0] == '\r' && p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+            {
+                return p;
+            }
+        }
+
+        return nullptr;
+    }
+
+#ifdef BUFFER_SEARCH_X86
+    //---------------- SSE2实现, 每次比较16字节 ----------------
+
+    __attribute__((target("sse2"))) const char *Sse2FindByte(const char *begin, const char *end, char c)
+    {
+        const __m128i needle = _mm_set1_epi8(c);
+        const char *p = begin;
+        for(; p + 16 <= end; p += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+            if(mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+
+        return ScalarFindByte(p, end, c);
+    }
+
+    __attribute__((target("sse2"))) const char *Sse2FindAnyOf(const char *begin, const char *end, const char *chars, size_t count)
+    {
+        if(count == 0 || count > BufferSearch::MAX_SIMD_SET_SIZE)
+        {
+            return ScalarFindAnyOf(begin, end, chars, count);
+        }
+
+        __m128i needles[BufferSearch::MAX_SIMD_SET_SIZE];
+        for(size_t i = 0; i < count; ++i)
+        {
+            needles[i] = _mm_set1_epi8(chars[i]);
+        }
+
+        const char *p = begin;
+        for(; p + 16 <= end; p += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            __m128i hit = _mm_cmpeq_epi8(block, needles[0]);
+            for(size_t i = 1; i < count; ++i)
+            {
+                hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, needles[i]));
+            }
+
+            int mask = _mm_movemask_epi8(hit);
+            if(mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+
+        return ScalarFindAnyOf(p, end, chars, count);
+    }
+
+    __attribute__((target("sse2"))) const char *Sse2FindCRLF(const char *begin, const char *end)
+    {
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        const char *p = begin;
+        for(; p + 17 <= end; p += 16)
+        {
+            __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+            int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, cr), _mm_cmpeq_epi8(second, lf)));
+            if(mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+
+        return ScalarFindCRLF(p, end);
+    }
+
+    __attribute__((target("sse2"))) const char *Sse2FindDoubleCRLF(const char *begin, const char *end)
+    {
+        const __m128i cr = _mm_set1_epi8('\r');
+        const __m128i lf = _mm_set1_epi8('\n');
+        const char *p = begin;
+        for(; p + 19 <= end; p += 16)
+        {
+            __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+            __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+            __m128i b2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 2));
+            __m128i b3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 3));
+            __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, cr), _mm_cmpeq_epi8(b1, lf)),
+                                        _mm_and_si128(_mm_cmpeq_epi8(b2, cr), _mm_cmpeq_epi8(b3, lf)));
+            int mask = _mm_movemask_epi8(hit);
+            if(mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+
+        return ScalarFindDoubleCRLF(p, end);
+    }
+
+    //---------------- AVX2实现, 每次比较32字节 ----------------
+
+    __attribute__((target("avx2"))) const char *Avx2FindByte(const char *begin, const char *end, char c)
+    {
+        const __m256i needle = _mm256_set1_epi8(c);
+        const char *p = begin;
+        for(; p + 32 <= end; p += 32)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+            if(mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+
+        return Sse2FindByte(p, end, c);
+    }
+
+    __attribute__((target("avx2"))) const char *Avx2FindAnyOf(const char *begin, const char *end, const char *chars, size_t count)
+    {
+        if(count == 0 || count > BufferSearch::MAX_SIMD_SET_SIZE)
+        {
+            return ScalarFindAnyOf(begin, end, chars, count);
+        }
+
+        __m256i needles[BufferSearch::MAX_SIMD_SET_SIZE];
+        for(size_t i = 0; i < count; ++i)
+        {
+            needles[i] = _mm256_set1_epi8(chars[i]);
+        }
+
+        const char *p = begin;
+        for(; p + 32 <= end; p += 32)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            __m256i hit = _mm256_cmpeq_epi8(block, needles[0]);
+            for(size_t i = 1; i < count; ++i)
+            {
+                hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, needles[i]));
+            }
+
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+            if(mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+
+        return Sse2FindAnyOf(p, end, chars, count);
+    }
+
+    __attribute__((target("avx2"))) const char *Avx2FindCRLF(const char *begin, const char *end)
+    {
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        const char *p = begin;
+        for(; p + 33 <= end; p += 32)
+        {
+            __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                    _mm256_and_si256(_mm256_cmpeq_epi8(first, cr), _mm256_cmpeq_epi8(second, lf))));
+            if(mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+
+        return Sse2FindCRLF(p, end);
+    }
+
+    __attribute__((target("avx2"))) const char *Avx2FindDoubleCRLF(const char *begin, const char *end)
+    {
+        const __m256i cr = _mm256_set1_epi8('\r');
+        const __m256i lf = _mm256_set1_epi8('\n');
+        const char *p = begin;
+        for(; p + 35 <= end; p += 32)
+        {
+            __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+            __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+            __m256i b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 2));
+            __m256i b3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 3));
+            __m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, cr), _mm256_cmpeq_epi8(b1, lf)),
+                                           _mm256_and_si256(_mm256_cmpeq_epi8(b2, cr), _mm256_cmpeq_epi8(b3, lf)));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+            if(mask)
+            {
+                return p + __builtin_ctz(mask);
+            }
+        }
+
+        return Sse2FindDoubleCRLF(p, end);
+    }
+#endif
+
+    const SearchKernels KERNELS[BufferSearch::SI_COUNT] =
+    {
+        {ScalarFindByte, ScalarFindAnyOf, ScalarFindCRLF, ScalarFindDoubleCRLF},
+#ifdef BUFFER_SEARCH_X86
+        {Sse2FindByte, Sse2FindAnyOf, Sse2FindCRLF, Sse2FindDoubleCRLF},
+        {Avx2FindByte, Avx2FindAnyOf, Avx2FindCRLF, Avx2FindDoubleCRLF},
+#else
+        {ScalarFindByte, ScalarFindAnyOf, ScalarFindCRLF, ScalarFindDoubleCRLF},
+        {ScalarFindByte, ScalarFindAnyOf, ScalarFindCRLF, ScalarFindDoubleCRLF},
+#endif
+    };
+
+    BufferSearch::SEARCH_IMPL DetectBestImpl()
+    {
+#ifdef BUFFER_SEARCH_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+        {
+            return BufferSearch::SI_AVX2;
+        }
+
+        if(__builtin_cpu_supports("sse2"))
+        {
+            return BufferSearch::SI_SSE2;
+        }
+#endif
+        return BufferSearch::SI_SCALAR;
+    }
+
+    std::atomic<const SearchKernels *> &ActiveKernels()
+    {
+        static std::atomic<const SearchKernels *> active(&KERNELS[DetectBestImpl()]);
+        return active;
+    }
+}
+
+const char* BufferSearch::FindByte(const char *begin, const char *end, char c)
+{
+    return ActiveKernels().load(std::memory_order_relaxed)->find_byte(begin, end, c);
+}
+
+const char* BufferSearch::FindAnyOf(const char *begin, const char *end, const char *chars, size_t count)
+{
+    return ActiveKernels().load(std::memory_order_relaxed)->find_any_of(begin, end, chars, count);
+}
+
+const char* BufferSearch::FindCRLF(const char *begin, const char *end)
+{
+    return ActiveKernels().load(std::memory_order_relaxed)->find_crlf(begin, end);
+}
+
+const char* BufferSearch::FindDoubleCRLF(const char *begin, const char *end)
+{
+    return ActiveKernels().load(std::memory_order_relaxed)->find_double_crlf(begin, end);
+}
+
+BufferSearch::SEARCH_IMPL BufferSearch::GetImpl()
+{
+    return static_cast<SEARCH_IMPL>(ActiveKernels().load(std::memory_order_relaxed) - KERNELS);
+}
+
+BufferSearch::SEARCH_IMPL BufferSearch::GetBestImpl()
+{
+    static const SEARCH_IMPL best = DetectBestImpl();
+    return best;
+}
+
+bool BufferSearch::SetImpl(SEARCH_IMPL impl)
+{
+    if(impl < SI_SCALAR || impl >= SI_COUNT || impl > GetBestImpl())
+    {
+        return false;
+    }
+
+    ActiveKernels().store(&KERNELS[impl], std::memory_order_relaxed);
+    return true;
+}
+
+const char* BufferSearch::GetImplName(SEARCH_IMPL impl)
+{
+    switch(impl)
+    {
+        case SI_SCALAR:
+            return "scalar";
+        case SI_SSE2:
+            return "sse2";
+        case SI_AVX2:
+            return "avx2";
+        default:
+            return "unknown";
+    }
+}
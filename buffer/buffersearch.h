@@ -0,0 +1,36 @@
+//
+// Created by ciaowhen on 2023/5/10.
+//
+
+#ifndef ADVANCECODE_BUFFERSEARCH_H
+#define ADVANCECODE_BUFFERSEARCH_H
+
+#include <cstddef>
+
+//协议解析用的分隔符查找, 启动时按CPU选择AVX2/SSE2/标量实现
+//所有接口在[begin, end)中查找, 找不到返回nullptr
+class BufferSearch
+{
+public:
+    enum SEARCH_IMPL
+    {
+        SI_SCALAR = 0,
+        SI_SSE2,
+        SI_AVX2,
+        SI_COUNT,
+    };
+
+    static const char *FindByte(const char *begin, const char *end, char c);
+    static const char *FindAnyOf(const char *begin, const char *end, const char *chars, size_t count);
+    static const char *FindCRLF(const char *begin, const char *end);
+    static const char *FindDoubleCRLF(const char *begin, const char *end);
+
+    static SEARCH_IMPL GetImpl();
+    static SEARCH_IMPL GetBestImpl();                   //当前CPU支持的最快实现
+    static bool SetImpl(SEARCH_IMPL impl);              //强制指定实现(基准测试用), CPU不支持时返回false
+    static const char *GetImplName(SEARCH_IMPL impl);
+
+    static const size_t MAX_SIMD_SET_SIZE = 16;         //FindAnyOf超过该字符数时走查表实现
+};
+
+#endif //ADVANCECODE_BUFFERSEARCH_H
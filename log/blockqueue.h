@@ -5,11 +5,14 @@
 #ifndef ADVANCECODE_BLOCKQUEUE_H
 #define ADVANCECODE_BLOCKQUEUE_H
 
+#include <algorithm>
 #include <deque>
 #include <mutex>
+#include <chrono>
 #include <condition_variable>
 #include <sys/time.h>
 #include <cassert>
+#include <utility>
 
 template<class T>
 class BlockDeque
@@ -19,6 +22,7 @@ public:
     ~BlockDeque();
     void Clear();
     void Close();
+    bool IsClosed();
     bool IsEmpty();
     bool IsFull();
     size_t GetQueueSize();
@@ -26,12 +30,28 @@ public:
     T GetFront();
     T GetBack();
     void PushBack(const T &item);
+    void PushBack(T &&item);
+    template<class... Args>
+    void Emplace(Args&&... args);                       //在队尾原地构造
     void PushFront(const T &item);
+    bool TryPushBack(const T &item);                    //满了或已关闭时返回false, 不等待
+    bool TryPushBack(T &&item);                         //失败时item保持原样
     bool PopFront(T &item);
-    bool PopFront(T &item, int timeout);
+    bool TryPopFront(T &item);                          //为空时返回false, 不等待
+    bool PopFront(T &item, int timeout);                //timeout单位为秒
+    bool PopFront(T &item, std::chrono::milliseconds timeout);
+    //一次加锁取走队列里现有的全部元素, 为空时等待; 关闭后返回false
+    bool PopAll(std::deque<T> &items);
+    //一次加锁把至多max个元素追加到out末尾, 为空时最多等timeout(小于0时一直等), 返回取出的个数
+    template<class Container>
+    size_t DrainTo(Container &out, size_t max, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
     void Flush();
 
 private:
+    template<class U>
+    void PushBackImpl(U &&item);
+    bool WaitNotEmpty(std::unique_lock<std::mutex> &locker, std::chrono::milliseconds timeout);
+
     std::deque<T> m_block_queue;
     size_t m_capacity;
     std::mutex m_mutex;
@@ -74,6 +94,13 @@ void BlockDeque<T>::Clear()
     m_block_queue.clear();
 }
 
+template<class T>
+bool BlockDeque<T>::IsClosed()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_close;
+}
+
 template<class T>
 bool BlockDeque<T>::IsEmpty()
 {
@@ -118,14 +145,52 @@ T BlockDeque<T>::GetBack()
 
 template<class T>
 void BlockDeque<T>::PushBack(const T &item)
+{
+    PushBackImpl(item);
+}
+
+template<class T>
+void BlockDeque<T>::PushBack(T &&item)
+{
+    PushBackImpl(std::move(item));
+}
+
+template<class T>
+template<class... Args>
+void BlockDeque<T>::Emplace(Args&&... args)
 {
     std::unique_lock<std::mutex> locker(m_mutex);
-    while(m_block_queue.size() >= m_capacity)
+    while(m_block_queue.size() >= m_capacity && !m_close)
     {
         m_producer.wait(locker);
     }
 
-    m_block_queue.push_back(item);
+    //关闭后丢弃, 不再入队
+    if(m_close)
+    {
+        return;
+    }
+
+    m_block_queue.emplace_back(std::forward<Args>(args)...);
+    m_consumer.notify_one();
+}
+
+template<class T>
+template<class U>
+void BlockDeque<T>::PushBackImpl(U &&item)
+{
+    std::unique_lock<std::mutex> locker(m_mutex);
+    while(m_block_queue.size() >= m_capacity && !m_close)
+    {
+        m_producer.wait(locker);
+    }
+
+    if(m_close)
+    {
+        return;
+    }
+
+    m_block_queue.push_back(std::forward<U>(item));
     m_consumer.notify_one();
 }
 
@@ -133,29 +198,58 @@ template<class T>
 void BlockDeque<T>::PushFront(const T &item)
 {
     std::unique_lock<std::mutex> locker(m_mutex);
-    while(m_block_queue.size() >= m_capacity)
+    while(m_block_queue.size() >= m_capacity && !m_close)
     {
         m_producer.wait(locker);
     }
 
+    if(m_close)
+    {
+        return;
+    }
+
     m_block_queue.push_front(item);
     m_consumer.notify_one();
 }
 
+template<class T>
+bool BlockDeque<T>::TryPushBack(const T &item)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    if(m_close || m_block_queue.size() >= m_capacity)
+    {
+        return false;
+    }
+
+    m_block_queue.push_back(item);
+    m_consumer.notify_one();
+    return true;
+}
+
+template<class T>
+bool BlockDeque<T>::TryPushBack(T &&item)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    if(m_close || m_block_queue.size() >= m_capacity)
+    {
+        return false;
+    }
+
+    m_block_queue.push_back(std::move(item));
+    m_consumer.notify_one();
+    return true;
+}
+
 template<class T>
 bool BlockDeque<T>::PopFront(T &item)
 {
     std::unique_lock<std::mutex> locker(m_mutex);
-    while(m_block_queue.empty())
+    if(!WaitNotEmpty(locker, std::chrono::milliseconds(-1)))
     {
-        m_consumer.wait(locker);
-        if(m_close)
-        {
-            return false;
-        }
+        return false;
     }
 
-   item = m_block_queue.pop_front();
+    item = std::move(m_block_queue.front());
     m_block_queue.pop_front();
     m_producer.notify_one();
     return true;
@@ -163,22 +257,89 @@ bool BlockDeque<T>::PopFront(T &item)
 
 template<class T>
 bool BlockDeque<T>::PopFront(T &item, int timeout)
+{
+    return PopFront(item, std::chrono::seconds(timeout));
+}
+
+template<class T>
+bool BlockDeque<T>::PopFront(T &item, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> locker(m_mutex);
+    if(!WaitNotEmpty(locker, timeout))
+    {
+        return false;
+    }
+
+    item = std::move(m_block_queue.front());
+    m_block_queue.pop_front();
+    m_producer.notify_one();
+    return true;
+}
+
+template<class T>
+bool BlockDeque<T>::PopAll(std::deque<T> &items)
+{
+    std::unique_lock<std::mutex> locker(m_mutex);
+    if(!WaitNotEmpty(locker, std::chrono::milliseconds(-1)))
+    {
+        return false;
+    }
+
+    items.clear();
+    items.swap(m_block_queue);
+    m_producer.notify_all();
+    return true;
+}
+
+template<class T>
+template<class Container>
+size_t BlockDeque<T>::DrainTo(Container &out, size_t max, std::chrono::milliseconds timeout)
 {
     std::unique_lock<std::mutex> locker(m_mutex);
-    while(m_block_queue.empty())
+    if(!WaitNotEmpty(locker, timeout))
     {
-        if(m_consumer.wait_for(locker, std::chrono::seconds(timeout)) == std::cv_status::timeout)
-        {
-            return false;
-        }
+        return 0;
+    }
 
-        if(m_close)
-        {
-            return false;
-        }
+    size_t count = std::min(max, m_block_queue.size());
+    for(size_t i = 0; i < count; ++i)
+    {
+        out.push_back(std::move(m_block_queue.front()));
+        m_block_queue.pop_front();
+    }
+
+    //一次腾出了多个位置, 等待中的生产者全部唤醒
+    m_producer.notify_all();
+    return count;
+}
+
+//关闭或超时返回false; timeout小于0时一直等
+template<class T>
+bool BlockDeque<T>::WaitNotEmpty(std::unique_lock<std::mutex> &locker, std::chrono::milliseconds timeout)
+{
+    auto ready = [this]{ return m_close || !m_block_queue.empty(); };
+    if(timeout.count() < 0)
+    {
+        m_consumer.wait(locker, ready);
+    }
+    else if(!m_consumer.wait_for(locker, timeout, ready))
+    {
+        return false;
+    }
+
+    return !m_close;
+}
+
+template<class T>
+bool BlockDeque<T>::TryPopFront(T &item)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    if(m_block_queue.empty())
+    {
+        return false;
     }
 
-    item = m_block_queue.pop_front();
+    item = std::move(m_block_queue.front());
     m_block_queue.pop_front();
     m_producer.notify_one();
     return true;
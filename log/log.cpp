@@ -4,8 +4,14 @@
 
 #include "log.h"
 #include <stdarg.h>
+#include <cerrno>
+#include <climits>
+#include <cstring>
 
-Log::Log():m_path(nullptr),m_suffix(nullptr), m_max_lines(0),m_line_count(0),m_today(0),m_level(0),is_open(false), is_async(false),m_file(nullptr),m_block_deque(nullptr),m_write_thread(nullptr)
+Log::Log():m_path(nullptr),m_suffix(nullptr), m_max_lines(0),m_line_count(0),m_file_index(0),m_next_day(0),m_next_day_prepared(false),m_level(0),m_microseconds(false),m_flush_policy(FP_ON_ERROR),is_open(false), is_async(false),m_binary(false),m_async_mode(AM_BLOCK_DEQUE),m_file(nullptr),m_segment_size(0),m_sync_interval_ms(1000),m_block_deque(nullptr),m_write_thread(nullptr),
+    m_chunk_close(false),m_collect_request(false),m_flush_interval_ms(1000),
+    m_overflow_policy(OP_WRITE_THROUGH),m_sample_rate(100),m_sample_count(0),m_rate_interval_ns(0),m_rate_burst_ns(0),m_written_through(0),m_blocked(0),
+    m_dropped_newest(0),m_dropped_oldest(0),m_sampled_out(0),m_rate_limited(0),m_rate_reported(0),m_written_lines(0)
 {
 
 }
@@ -14,131 +20,352 @@ Log::~Log()
 {
         if(m_write_thread && m_write_thread->joinable())
         {
-            while(!m_block_deque->IsEmpty())
+            if(m_async_mode == AM_RING)
             {
-                m_block_deque->Flush();
+                m_ring->Close();
+            }
+            else if(m_async_mode == AM_THREAD_BUFFER)
+            {
+                std::lock_guard<std::mutex> locker(m_chunk_mutex);
+                m_chunk_close = true;
+                m_chunk_cond.notify_one();
+            }
+            else if(m_async_mode == AM_MPMC_QUEUE)
+            {
+                CloseQueue(*m_mpmc_queue);
+            }
+            else
+            {
+                CloseQueue(*m_block_deque);
             }
 
-            m_block_deque->Close();
             m_write_thread->join();
         }
 
-        if(m_file)
-        {
-            std::lock_guard<std::mutex> locker(m_mutex);
-            Flush();
-            fclose(m_file);
-        }
+        std::lock_guard<std::mutex> locker(m_mutex);
+        CloseFileLocked();
 }
 
-void Log::Init(int level, const char *path, const char *suffix, int max_queue_capacity)
+void Log::Init(int level, const char *path, const char *suffix, int max_queue_capacity, ASYNC_MODE async_mode, bool binary)
 {
     is_open = true;
-    m_level = level;
-    if(max_queue_capacity > 0)
+    m_binary = binary;
+    m_level.store(level);
+    time_t now_time = time(nullptr);
+    struct tm sys_time;
+    localtime_r(&now_time, &sys_time);
+
+    //重复Init时写线程可能正在切分文件, 文件相关的状态都在锁内更新
     {
-        is_async = true;
-        if(!m_block_deque)
-        {
-            std::unique_ptr<BlockDeque<std::string>> new_deque(new BlockDeque<std::string>);
-            new_deque = std::move(new_deque);
-            std::unique_ptr<std::thread> new_thread(new std::thread(FlushLogThread));
-            m_write_thread = std::move(new_thread);
-        }
-        else
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_path = path;
+        m_suffix = suffix;
+        m_line_count = 0;
+        m_file_index = 0;
+        m_next_day = GetNextDay(sys_time);
+        m_buff.Clear();
+        if(m_segment_size > 0 && !m_segment)
         {
-            is_async = false;
+            m_segment.reset(new LogSegmentWriter(m_segment_size, m_sync_interval_ms));
         }
-    }
 
-    m_line_count = 0;
-    time_t now_time = time(nullptr);
-    struct tm *sys_time = localtime(&now_time);
-    m_path = path;
-    m_suffix = suffix;
-    char file_name[LOG_NAME_LEN] = {0};
-    snprintf(file_name,LOG_NAME_LEN - 1, "%s%04d_%02d_%02d%s", m_path, sys_time->tm_year + 1990, sys_time->tm_mon + 1, sys_time->tm_mday, m_suffix);
-    m_today = sys_time->tm_mday;
+        CloseFileLocked();
+        OpenFileLocked(sys_time, 0);
+    }
 
+    //写线程只创建一次, 重复Init时沿用第一次的异步模式
+    is_async = max_queue_capacity > 0;
+    if(is_async && !m_write_thread)
     {
-        std::lock_guard<std::mutex> locker(m_mutex);
-        m_buff.Clear();
-        if(m_file)
+        m_async_mode = async_mode;
+        if(async_mode == AM_RING)
+        {
+            m_ring.reset(new LogRing(max_queue_capacity));
+        }
+        else if(async_mode == AM_BLOCK_DEQUE)
         {
-            Flush();
-            fclose(m_file);
+            m_block_deque.reset(new BlockDeque<std::string>(max_queue_capacity));
+        }
+        else if(async_mode == AM_MPMC_QUEUE)
+        {
+            m_mpmc_queue.reset(new MpmcQueue<std::string>(max_queue_capacity));
         }
 
-        m_file = fopen(file_name, "a");
-        if(!m_file)
+        m_write_thread.reset(new std::thread(FlushLogThread));
+    }
+}
+
+namespace
+{
+    struct PrintfBody
+    {
+        const char *format;
+        va_list valist;
+    };
+
+    size_t FormatPrintfBody(char *dst, size_t size, void *context)
+    {
+        PrintfBody *body = static_cast<PrintfBody *>(context);
+        if(size == 0)
         {
-            mkdir(m_path, 0777);
-            m_file = fopen(file_name, "a");
+            return 0;
         }
 
-        assert(m_file != nullptr);
+        //vsnprintf总在末尾写'\0', 截断时最后一个字节是'\0'而不是内容, 不计入长度
+        int n = vsnprintf(dst, size, body->format, body->valist);
+        return n > 0 ? std::min(static_cast<size_t>(n), size - 1) : 0;
     }
 }
 
 void Log::Write(int level, const char *format, ...)
 {
-    time_t now_time = time(0);
-    struct tm *sys_time = localtime(&now_time);
-    va_list valist;
+    PrintfBody body;
+    body.format = format;
+    va_start(body.valist, format);
+    WriteBody(level, FormatPrintfBody, &body);
+    va_end(body.valist);
+}
 
-    if(m_today != sys_time->tm_mday || (m_line_count && (m_line_count % LOG_MAX_LINES == 0)))
+namespace
+{
+    struct LineContext
     {
-        std::unique_lock<std::mutex> locker(m_mutex);
-        locker.unlock();
+        int level;
+        size_t (*formatter)(char *dst, size_t size, void *context);
+        void *context;
+        Log *log;
+    };
+}
+
+void Log::WriteBody(int level, BodyFormatter formatter, void *context)
+{
+    LineContext line = {level, formatter, context, this};
+    EmitRecord(level, m_binary ? EncodeTextRecord : EncodeLine, &line);
+}
+
+size_t Log::EncodeLine(char *dst, size_t size, void *context)
+{
+    LineContext *line = static_cast<LineContext *>(context);
+    return line->log->FormatLine(dst, size, line->level, line->formatter, line->context);
+}
+
+//printf风格的Write在二进制模式下没有调用点编号, 格式化好的正文整段写进RT_TEXT记录
+size_t Log::EncodeTextRecord(char *dst, size_t size, void *context)
+{
+    LineContext *line = static_cast<LineContext *>(context);
+    char body[MAX_LINE_LEN];
+    size_t len = line->formatter(body, sizeof(body), line->context);
+    return LogBinary::EncodeText(dst, size, line->level, body, len);
+}
+
+void Log::EmitRecord(int level, BodyFormatter encoder, void *context)
+{
+    //环形队列模式直接编码进抢到的槽位, 不加锁; 队列满时按溢出策略处理
+    if(is_async && m_async_mode == AM_RING)
+    {
+        uint64_t ticket = 0;
+        char *slot = m_ring->TryClaim(&ticket);
+        if(!slot)
+        {
+            OVERFLOW_ACTION action = OnOverflow();
+            if(action == OA_DROP_OLDEST)
+            {
+                m_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
 
-        char new_file_name[LOG_NAME_LEN];
-        char tail[36] = {0};
-        std::snprintf(tail, 36, "%04d_%02d_%02d", sys_time->tm_year + 1900, sys_time->tm_mon + 1, sys_time->tm_mday);
+            if(action == OA_DROP)
+            {
+                return;
+            }
+
+            if(action == OA_WAIT)
+            {
+                m_ring->Notify();
+                while(!slot && !m_ring->IsClosed())
+                {
+                    std::this_thread::yield();
+                    slot = m_ring->TryClaim(&ticket);
+                }
+            }
+        }
 
-        if(m_today != sys_time->tm_mday)
+        if(slot)
         {
-            snprintf(new_file_name, LOG_NAME_LEN - 72, "%s/%s%s", m_path,tail, m_suffix);
-            m_today = sys_time->tm_mday;
-            m_line_count = 0;
+            m_ring->Publish(ticket, encoder(slot, LogRing::DATA_SIZE, context));
+            FlushByPolicy(level);
+            return;
         }
-        else
+    }
+
+    //线程缓冲区模式只锁本线程的缓冲区, 写满时才去碰全局锁
+    //写线程关闭后不再分配和交出缓冲区, 退回下面的同步写; 关闭前写进缓冲区的内容由写线程最后一次收集带走
+    ThreadBuffer *buffer = is_async && m_async_mode == AM_THREAD_BUFFER ? GetThreadBuffer() : nullptr;
+    if(buffer)
+    {
+        std::lock_guard<std::mutex> locker(buffer->mtx);
+        if(!m_chunk_close && THREAD_BUFFER_SIZE - buffer->current.len < MAX_LINE_LEN)
         {
-            snprintf(new_file_name, LOG_NAME_LEN - 72, "%s/%s-%d%s", m_path, tail, m_line_count / LOG_MAX_LINES, m_suffix);
+            std::unique_lock<std::mutex> chunk_locker(m_chunk_mutex);
+            if(!m_chunk_close && m_full_chunks.size() >= MAX_PENDING_CHUNKS)
+            {
+                //整块缓冲区没法同步写出, 写穿策略在这里也是等待
+                OVERFLOW_ACTION action = OnOverflow(false);
+                if(action == OA_DROP)
+                {
+                    return;
+                }
+
+                //丢掉排在最前面的整块, 缓冲区回收复用
+                if(action == OA_DROP_OLDEST)
+                {
+                    m_dropped_oldest.fetch_add(m_full_chunks.front().lines, std::memory_order_relaxed);
+                    if(m_free_chunks.size() < MAX_FREE_CHUNKS)
+                    {
+                        m_free_chunks.push_back(std::move(m_full_chunks.front().data));
+                    }
+
+                    m_full_chunks.erase(m_full_chunks.begin());
+                }
+            }
+
+            m_chunk_space.wait(chunk_locker, [this]{ return m_chunk_close || m_full_chunks.size() < MAX_PENDING_CHUNKS; });
+            if(!m_chunk_close)
+            {
+                HandOffLocked(*buffer);
+            }
+            else
+            {
+                //等待期间写线程关闭, 交出去的块可能已经没人写, 由当前线程直接写出
+                chunk_locker.unlock();
+                struct iovec iov = {buffer->current.data.get(), buffer->current.len};
+                std::lock_guard<std::mutex> write_locker(m_mutex);
+                WriteBatchLocked(&iov, 1, buffer->current.lines);
+                buffer->current.len = 0;
+                buffer->current.lines = 0;
+            }
         }
 
-        locker.lock();
-        Flush();
-        fclose(m_file);
-        m_file = fopen(new_file_name, "a");
-        assert(m_file != nullptr);
+        if(!m_chunk_close)
+        {
+            LogChunk &chunk = buffer->current;
+            chunk.len += encoder(chunk.data.get() + chunk.len, MAX_LINE_LEN, context);
+            chunk.lines++;
+            FlushByPolicy(level);
+            return;
+        }
     }
 
+    //OA_WAIT时先放开m_mutex再等待, 写线程写文件也要拿m_mutex
+    OVERFLOW_ACTION action = OA_WRITE_THROUGH;
+    std::string line;
     {
         std::unique_lock<std::mutex> locker(m_mutex);
-        m_line_count++;
-        int n = snprintf(m_buff.GetBeginWritePos(), 128, "%d-%02d-%02d %02d:%02d:%02d",
-                         sys_time->tm_year + 1990, sys_time->tm_mon + 1, sys_time->tm_mday, sys_time->tm_hour, sys_time->tm_min, sys_time->tm_sec);
-
-        m_buff.RefreshWritePos(n);
-        AppendLogLevelTitle(m_level);
-
-        va_start(valist, format);
-        int m = snprintf(m_buff.GetBeginWritePos(), m_buff.GetWritableBytes(), format, valist);
-        va_end(valist);
-        m_buff.RefreshWritePos(m);
-        m_buff.Append("\n\0", 2);
+        m_buff.SetEnsureWritable(MAX_LINE_LEN);
+        m_buff.RefreshWritePos(encoder(m_buff.GetBeginWritePos(), MAX_LINE_LEN, context));
 
-        if(is_async && m_block_deque && !m_block_deque->IsFull())
+        if(is_async && m_async_mode == AM_BLOCK_DEQUE)
         {
-            m_block_deque->PushBack(m_buff.RetrieveToStr());
+            line = m_buff.RetrieveToStr();
+            action = EnqueueLineLocked(*m_block_deque, line);
+        }
+        else if(is_async && m_async_mode == AM_MPMC_QUEUE)
+        {
+            line = m_buff.RetrieveToStr();
+            action = EnqueueLineLocked(*m_mpmc_queue, line);
         }
         else
         {
-            fputs(m_buff.GetCurrReadPos(), m_file);
+            WriteLocked(m_buff.GetCurrReadPos(), m_buff.GetReadableBytes(), 1);
         }
 
         m_buff.Clear();
     }
+
+    if(action == OA_DROP)
+    {
+        return;
+    }
+
+    if(action == OA_WAIT && m_async_mode == AM_MPMC_QUEUE)
+    {
+        m_mpmc_queue->PushBack(std::move(line));
+    }
+    else if(action == OA_WAIT)
+    {
+        m_block_deque->PushBack(std::move(line));
+    }
+
+    FlushByPolicy(level);
+}
+
+Log::OVERFLOW_ACTION Log::OnOverflow(bool can_write_through)
+{
+    switch(m_overflow_policy.load(std::memory_order_relaxed))
+    {
+        case OP_BLOCK:
+            m_blocked.fetch_add(1, std::memory_order_relaxed);
+            return OA_WAIT;
+        case OP_DROP_NEWEST:
+            m_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+            return OA_DROP;
+        case OP_DROP_OLDEST:
+            return OA_DROP_OLDEST;
+        case OP_SAMPLE:
+        {
+            uint64_t rate = static_cast<uint64_t>(std::max(1, m_sample_rate.load(std::memory_order_relaxed)));
+            if(m_sample_count.fetch_add(1, std::memory_order_relaxed) % rate == 0)
+            {
+                m_blocked.fetch_add(1, std::memory_order_relaxed);
+                return OA_WAIT;
+            }
+
+            m_sampled_out.fetch_add(1, std::memory_order_relaxed);
+            return OA_DROP;
+        }
+        default:
+            if(!can_write_through)
+            {
+                m_blocked.fetch_add(1, std::memory_order_relaxed);
+                return OA_WAIT;
+            }
+
+            m_written_through.fetch_add(1, std::memory_order_relaxed);
+            return OA_WRITE_THROUGH;
+    }
+}
+
+//GCRA形式的令牌桶: 每个调用点只存一个理论到达时间, 一次CAS完成取令牌
+bool Log::AdmitSite(LogSite &site)
+{
+    uint64_t interval = m_rate_interval_ns.load(std::memory_order_relaxed);
+    uint64_t burst = m_rate_burst_ns.load(std::memory_order_relaxed);
+    uint64_t now = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    uint64_t next = site.next_ns.load(std::memory_order_relaxed);
+    while(true)
+    {
+        uint64_t base = std::max(next, now);
+        if(base - now > burst)
+        {
+            site.suppressed.fetch_add(1, std::memory_order_relaxed);
+            m_rate_limited.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        if(site.next_ns.compare_exchange_weak(next, base + interval, std::memory_order_relaxed))
+        {
+            break;
+        }
+    }
+
+    uint64_t suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+    if(suppressed > 0)
+    {
+        Print(site.level, "{} messages suppressed at {}:{}", suppressed, site.file, site.line);
+    }
+
+    return true;
 }
 
 Log* Log::Instance()
@@ -154,54 +381,724 @@ void Log::FlushLogThread()
 
 void Log::Flush()
 {
+    ReportSuppressed(true);
     if(is_async)
     {
-        m_block_deque->Flush();
+        if(m_async_mode == AM_RING)
+        {
+            m_ring->Notify();
+        }
+        else if(m_async_mode == AM_THREAD_BUFFER)
+        {
+            std::lock_guard<std::mutex> locker(m_chunk_mutex);
+            m_collect_request = true;
+            m_chunk_cond.notify_one();
+        }
+        else if(m_async_mode == AM_MPMC_QUEUE)
+        {
+            m_mpmc_queue->Flush();
+        }
+        else
+        {
+            m_block_deque->Flush();
+        }
     }
 
-    fflush(m_file);
+    std::lock_guard<std::mutex> locker(m_mutex);
+    if(m_segment)
+    {
+        m_segment->Flush();
+    }
+    else if(m_file)
+    {
+        fflush(m_file);
+    }
+}
+
+void Log::FlushByPolicy(int level)
+{
+    int policy = m_flush_policy.load(std::memory_order_relaxed);
+    if(policy == FP_ALWAYS || (policy == FP_ON_ERROR && level >= LL_ERROR))
+    {
+        Flush();
+    }
 }
 
 int Log::GetLevel()
 {
-    std::lock_guard<std::mutex> locker(m_mutex);
-    return m_level;
+    return m_level.load(std::memory_order_relaxed);
 }
 
 void Log::SetLevel(int level)
+{
+    m_level.store(level, std::memory_order_relaxed);
+}
+
+void Log::SetFlushPolicy(FLUSH_POLICY policy)
+{
+    m_flush_policy.store(policy, std::memory_order_relaxed);
+}
+
+void Log::SetMicroseconds(bool enable)
+{
+    m_microseconds.store(enable, std::memory_order_relaxed);
+}
+
+//编号在进程内唯一; 二进制模式下格式串记录直接写进当前文件, 先于任何引用它的事件记录落盘
+void Log::RegisterSite(LogSite *site)
 {
     std::lock_guard<std::mutex> locker(m_mutex);
-    m_level = level;
+    m_sites.push_back(site);
+    site->id = static_cast<uint32_t>(m_sites.size());
+    if(m_binary && (m_file || m_segment))
+    {
+        CheckRotateLocked(MAX_LINE_LEN);
+        WriteSiteLocked(*site);
+    }
+}
+
+void Log::WriteSiteLocked(LogSite &site)
+{
+    char record[MAX_LINE_LEN];
+    size_t len = LogBinary::EncodeFormat(record, sizeof(record), site.id, site.level, site.file, site.line, site.format);
+    if(len > 0)
+    {
+        OutputLocked(record, len);
+        return;
+    }
+
+    //报告一次, 之后该调用点改写文本记录, 事件不会因缺少字典而无法解码
+    if(!site.text.exchange(true, std::memory_order_relaxed))
+    {
+        char text[256];
+        int n = snprintf(text, sizeof(text), "log format at %s:%d is too long for the binary dictionary, writing text records", site.file, site.line);
+        WriteErrorLocked(text, std::min(static_cast<size_t>(std::max(n, 0)), sizeof(text) - 1));
+    }
+}
+
+namespace
+{
+    struct TextBody
+    {
+        const char *data;
+        size_t len;
+    };
+
+    size_t CopyTextBody(char *dst, size_t size, void *context)
+    {
+        TextBody *body = static_cast<TextBody *>(context);
+        size_t len = std::min(body->len, size);
+        memcpy(dst, body->data, len);
+        return len;
+    }
+}
+
+//按当前输出格式把一段正文编成文本行或RT_TEXT记录, record至少MAX_LINE_LEN字节
+size_t Log::FormatText(char *record, int level, const char *text, size_t len)
+{
+    if(m_binary)
+    {
+        return LogBinary::EncodeText(record, MAX_LINE_LEN, level, text, len);
+    }
+
+    TextBody body = {text, len};
+    return FormatLine(record, MAX_LINE_LEN, level, CopyTextBody, &body);
+}
+
+//持有m_mutex, 不能经LOG_*报告; 直接写一条错误记录
+void Log::WriteErrorLocked(const char *text, size_t len)
+{
+    char record[MAX_LINE_LEN];
+    OutputLocked(record, FormatText(record, LL_ERROR, text, len));
+}
+
+//被限流的条数除了在该调用点下次放行时补报, 写线程每隔SUPPRESS_REPORT_MS和Flush时也把积压的条数写出
+//不经队列直接写文件, 写线程自己不会因为队列满而等待; 没有新的限流时只读一次计数
+void Log::ReportSuppressed(bool force)
+{
+    if(m_rate_limited.load(std::memory_order_relaxed) == m_rate_reported.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    auto now = std::chrono::steady_clock::now();
+    if((!force && now < m_next_report) || (!m_file && !m_segment))
+    {
+        return;
+    }
+
+    m_next_report = now + std::chrono::milliseconds(SUPPRESS_REPORT_MS);
+    m_rate_reported.store(m_rate_limited.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    for(LogSite *site : m_sites)
+    {
+        uint64_t suppressed = site->suppressed.exchange(0, std::memory_order_relaxed);
+        if(suppressed == 0)
+        {
+            continue;
+        }
+
+        char text[256];
+        char record[MAX_LINE_LEN];
+        int n = snprintf(text, sizeof(text), "%llu messages suppressed at %s:%d", static_cast<unsigned long long>(suppressed), site->file, site->line);
+        WriteLocked(record, FormatText(record, site->level, text, std::min(static_cast<size_t>(std::max(n, 0)), sizeof(text) - 1)), 1);
+    }
+}
+
+void Log::SetMmapOutput(size_t segment_size, int sync_interval_ms)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_segment_size = segment_size;
+    m_sync_interval_ms = sync_interval_ms;
+}
+
+void Log::SetOverflowPolicy(OVERFLOW_POLICY policy, int sample_rate)
+{
+    m_sample_rate.store(sample_rate, std::memory_order_relaxed);
+    m_overflow_policy.store(policy, std::memory_order_relaxed);
+}
+
+void Log::SetRateLimit(int per_second, int burst)
+{
+    uint64_t interval = per_second > 0 ? 1000000000ull / static_cast<uint64_t>(per_second) : 0;
+    m_rate_burst_ns.store(interval * static_cast<uint64_t>(std::max(burst - 1, 0)), std::memory_order_relaxed);
+    m_rate_interval_ns.store(interval, std::memory_order_relaxed);
+}
+
+Log::OverflowStats Log::GetOverflowStats()
+{
+    OverflowStats stats;
+    stats.written_through = m_written_through.load(std::memory_order_relaxed);
+    stats.blocked = m_blocked.load(std::memory_order_relaxed);
+    stats.dropped_newest = m_dropped_newest.load(std::memory_order_relaxed);
+    stats.dropped_oldest = m_dropped_oldest.load(std::memory_order_relaxed);
+    stats.sampled_out = m_sampled_out.load(std::memory_order_relaxed);
+    stats.rate_limited = m_rate_limited.load(std::memory_order_relaxed);
+    return stats;
+}
+
+uint64_t Log::GetWrittenLines()
+{
+    return m_written_lines.load(std::memory_order_relaxed);
+}
+
+void Log::SetFlushInterval(int interval_ms)
+{
+    std::lock_guard<std::mutex> locker(m_chunk_mutex);
+    m_flush_interval_ms = interval_ms;
+    m_chunk_cond.notify_one();
 }
 
 void Log::AsyncWrite()
 {
-    std::string str = "";
-    while(m_block_deque->PopFront(str))
+    if(m_async_mode == AM_RING)
     {
+        RingWrite();
+        return;
+    }
+
+    if(m_async_mode == AM_THREAD_BUFFER)
+    {
+        ThreadBufferWrite();
+        return;
+    }
+
+    if(m_async_mode == AM_MPMC_QUEUE)
+    {
+        QueueWrite(*m_mpmc_queue);
+        return;
+    }
+
+    QueueWrite(*m_block_deque);
+}
+
+template<class Queue>
+Log::OVERFLOW_ACTION Log::EnqueueLineLocked(Queue &queue, std::string &line)
+{
+    if(queue.TryPushBack(std::move(line)))
+    {
+        return OA_WRITE_THROUGH;
+    }
+
+    //生产者都持有m_mutex, 出队腾出的位置不会被别人抢走
+    std::string oldest;
+    OVERFLOW_ACTION action = OnOverflow();
+    if(action == OA_DROP_OLDEST)
+    {
+        if(queue.TryPopFront(oldest))
+        {
+            m_dropped_oldest.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        //MpmcQueue的写线程可能还没读完前面的槽位, 这时仍然放不下
+        if(!queue.TryPushBack(std::move(line)))
+        {
+            m_dropped_newest.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    else if(action == OA_WRITE_THROUGH)
+    {
+        WriteLocked(line.data(), line.size(), 1);
+    }
+
+    return action;
+}
+
+//一次取走一批, 每批只加一次队列锁和文件锁
+template<class Queue>
+void Log::QueueWrite(Queue &queue)
+{
+    std::vector<std::string> lines;
+    lines.reserve(WRITE_BATCH);
+    while(true)
+    {
+        //限时等待, 空闲时也能补报被限流的条数; 超时或关闭时返回0
+        size_t count = queue.DrainTo(lines, WRITE_BATCH, std::chrono::milliseconds(SUPPRESS_REPORT_MS));
+        ReportSuppressed(false);
+        if(count == 0)
+        {
+            if(queue.IsClosed())
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        m_batch.clear();
+        for(const std::string &line : lines)
+        {
+            m_batch.append(line);
+        }
+
         std::lock_guard<std::mutex> locker(m_mutex);
-        fputs(str.c_str(), m_file);
+        WriteLocked(m_batch.data(), m_batch.size(), static_cast<int>(lines.size()));
+        lines.clear();
     }
 }
 
-void Log::AppendLogLevelTitle(int level)
+template<class Queue>
+void Log::CloseQueue(Queue &queue)
 {
-    switch (level) 
+    while(!queue.IsEmpty())
     {
-        case 0:
-            m_buff.Append("[DEBUG]: ", 9);
-            break;
-        case 1:
-            m_buff.Append("[INFO]: ", 9);
-            break;
-        case 2:
-            m_buff.Append("[WARN]: ", 9);
-            break;
-        case 3:
-            m_buff.Append("[ERROR]: ", 9);
-            break;
-        default:
-            m_buff.Append("[INFO]: ", 9);
+        queue.Flush();
+    }
+
+    queue.Close();
+}
+
+//一批记录合并成一次fwrite, 队列空闲时把已写内容刷到磁盘
+void Log::RingWrite()
+{
+    bool dirty = false;
+    while(true)
+    {
+        m_batch.clear();
+        size_t count = m_ring->Drain([this](const char *data, size_t len){ m_batch.append(data, len); }, WRITE_BATCH);
+        if(count > 0)
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            WriteLocked(m_batch.data(), m_batch.size(), static_cast<int>(count));
+            dirty = true;
+            continue;
+        }
+
+        if(dirty)
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if(m_file)
+            {
+                fflush(m_file);
+            }
+            dirty = false;
+        }
+
+        ReportSuppressed(false);
+        if(m_ring->IsClosed())
+        {
             break;
+        }
+
+        m_ring->Wait(RING_WAIT_MS);
+    }
+}
+
+//写满的缓冲区随时交过来; 定时或Flush时再把各线程未写满的缓冲区收走, 一批缓冲区用一次writev写出
+void Log::ThreadBufferWrite()
+{
+    std::vector<LogChunk> chunks;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::vector<struct iovec> iov;
+    auto next_collect = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_flush_interval_ms);
+    while(true)
+    {
+        bool closing = false;
+        bool collect = false;
+        {
+            std::unique_lock<std::mutex> locker(m_chunk_mutex);
+            if(m_full_chunks.empty() && !m_chunk_close && !m_collect_request)
+            {
+                m_chunk_cond.wait_until(locker, next_collect);
+            }
+
+            chunks.swap(m_full_chunks);
+            closing = m_chunk_close;
+            collect = closing || m_collect_request || std::chrono::steady_clock::now() >= next_collect;
+            m_collect_request = false;
+            if(collect)
+            {
+                buffers = m_thread_buffers;
+                next_collect = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_flush_interval_ms);
+            }
+        }
+
+        //先放出积压名额再去锁各线程的缓冲区, 等待名额的生产者正持有自己缓冲区的锁
+        m_chunk_space.notify_all();
+        ReportSuppressed(false);
+
+        if(collect)
+        {
+            std::vector<ThreadBuffer *> exited;
+            for(auto &buffer : buffers)
+            {
+                std::lock_guard<std::mutex> buffer_locker(buffer->mtx);
+                if(buffer->current.len > 0)
+                {
+                    std::lock_guard<std::mutex> locker(m_chunk_mutex);
+                    chunks.push_back(std::move(buffer->current));
+                    buffer->current.data = buffer->spare ? std::move(buffer->spare) : AcquireChunkLocked();
+                    buffer->current.len = 0;
+                    buffer->current.lines = 0;
+                }
+
+                if(buffer->closed)
+                {
+                    exited.push_back(buffer.get());
+                }
+            }
+
+            buffers.clear();
+            if(!exited.empty())
+            {
+                std::lock_guard<std::mutex> locker(m_chunk_mutex);
+                m_thread_buffers.erase(std::remove_if(m_thread_buffers.begin(), m_thread_buffers.end(), [&](const std::shared_ptr<ThreadBuffer> &buffer)
+                {
+                    return std::find(exited.begin(), exited.end(), buffer.get()) != exited.end();
+                }), m_thread_buffers.end());
+            }
+        }
+
+        if(chunks.empty())
+        {
+            if(closing)
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        int lines = 0;
+        iov.clear();
+        for(auto &chunk : chunks)
+        {
+            iov.push_back({chunk.data.get(), chunk.len});
+            lines += chunk.lines;
+        }
+
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            WriteBatchLocked(iov.data(), static_cast<int>(iov.size()), lines);
+        }
+
+        {
+            std::lock_guard<std::mutex> locker(m_chunk_mutex);
+            for(auto &chunk : chunks)
+            {
+                if(m_free_chunks.size() < MAX_FREE_CHUNKS)
+                {
+                    m_free_chunks.push_back(std::move(chunk.data));
+                }
+            }
+        }
+
+        chunks.clear();
+    }
+}
+
+Log::ThreadBuffer *Log::GetThreadBuffer()
+{
+    //线程退出时只做标记, 缓冲区里剩下的内容由写线程下次收集时写出
+    struct Holder
+    {
+        std::shared_ptr<ThreadBuffer> buffer;
+        ~Holder()
+        {
+            if(buffer)
+            {
+                std::lock_guard<std::mutex> locker(buffer->mtx);
+                buffer->closed = true;
+            }
+        }
+    };
+
+    static thread_local Holder holder;
+    if(!holder.buffer)
+    {
+        std::shared_ptr<ThreadBuffer> buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> locker(m_chunk_mutex);
+        //写线程已关闭, 登记的缓冲区不会再被收集
+        if(m_chunk_close)
+        {
+            return nullptr;
+        }
+
+        buffer->current.data = AcquireChunkLocked();
+        buffer->current.len = 0;
+        buffer->current.lines = 0;
+        m_thread_buffers.push_back(buffer);
+        holder.buffer = buffer;
+    }
+
+    return holder.buffer.get();
+}
+
+void Log::HandOffLocked(ThreadBuffer &buffer)
+{
+    m_full_chunks.push_back(std::move(buffer.current));
+    buffer.current.data = buffer.spare ? std::move(buffer.spare) : AcquireChunkLocked();
+    buffer.current.len = 0;
+    buffer.current.lines = 0;
+    if(!m_free_chunks.empty())
+    {
+        buffer.spare = std::move(m_free_chunks.back());
+        m_free_chunks.pop_back();
+    }
+
+    m_chunk_cond.notify_one();
+}
+
+std::unique_ptr<char[]> Log::AcquireChunkLocked()
+{
+    if(m_free_chunks.empty())
+    {
+        return std::unique_ptr<char[]>(new char[THREAD_BUFFER_SIZE]);
+    }
+
+    std::unique_ptr<char[]> chunk = std::move(m_free_chunks.back());
+    m_free_chunks.pop_back();
+    return chunk;
+}
+
+size_t Log::FormatLine(char *dst, size_t size, int level, BodyFormatter formatter, void *context)
+{
+    assert(size > 64);
+    size_t len = LogTimestamp::Format(dst, m_microseconds.load(std::memory_order_relaxed));
+    dst[len++] = ' ';
+    size_t title_len = 0;
+    const char *title = LogFormat::GetLevelTitle(level, &title_len);
+    memcpy(dst + len, title, title_len);
+    len += title_len;
+
+    //给结尾的换行留一个字节, 超长的内容被截断
+    len += formatter(dst + len, size - len - 1, context);
+
+    dst[len++] = '\n';
+    return len;
+}
+
+void Log::WriteLocked(const char *data, size_t len, int lines)
+{
+    CheckRotateLocked(len);
+    OutputLocked(data, len);
+    m_line_count += lines;
+    m_written_lines.fetch_add(lines, std::memory_order_relaxed);
+}
+
+void Log::OutputLocked(const char *data, size_t len)
+{
+    if(m_segment)
+    {
+        m_segment->Append(data, len);
+    }
+    else
+    {
+        fwrite(data, 1, len, m_file);
+    }
+}
+
+//绕过stdio缓冲直接writev; 普通文件只在磁盘满等出错时才会少写, 不做重试
+//mmap文件逐块拷贝, 放不下的块换到下一个文件, 一块内的日志行不会被拆开
+void Log::WriteBatchLocked(const struct iovec *iov, int count, int lines)
+{
+    if(m_segment)
+    {
+        for(int i = 0; i < count; ++i)
+        {
+            CheckRotateLocked(iov[i].iov_len);
+            m_segment->Append(static_cast<const char *>(iov[i].iov_base), iov[i].iov_len);
+        }
+
+        m_line_count += lines;
+        m_written_lines.fetch_add(lines, std::memory_order_relaxed);
+        return;
+    }
+
+    CheckRotateLocked(0);
+    fflush(m_file);
+    int fd = fileno(m_file);
+    for(int begin = 0; begin < count; begin += IOV_MAX)
+    {
+        writev(fd, iov + begin, std::min(IOV_MAX, count - begin));
+    }
+
+    m_line_count += lines;
+    m_written_lines.fetch_add(lines, std::memory_order_relaxed);
+}
+
+//按天, 按行数或mmap文件写满时切分文件; 异步模式下只有写线程会走到这里, 切分不会阻塞产生日志的线程
+//只和预先算好的次日零点比较, 跨天时才做日期换算
+void Log::CheckRotateLocked(size_t len)
+{
+    time_t now_time = time(nullptr);
+    if(m_segment && !m_next_day_prepared && now_time >= m_next_day - PREPARE_DAY_AHEAD && now_time < m_next_day)
+    {
+        PrepareNextLocked(now_time, m_file_index);
+    }
+
+    if(now_time >= m_next_day)
+    {
+        struct tm sys_time;
+        localtime_r(&now_time, &sys_time);
+        m_next_day = GetNextDay(sys_time);
+        m_line_count = 0;
+        m_file_index = 0;
+        SwitchFileLocked(sys_time, 0);
+    }
+    else if(m_line_count >= LOG_MAX_LINES || (m_segment && m_segment->GetRoom() < len))
+    {
+        struct tm sys_time;
+        localtime_r(&now_time, &sys_time);
+        m_line_count = 0;
+        m_file_index++;
+        SwitchFileLocked(sys_time, m_file_index);
     }
-}
\ No newline at end of file
+}
+
+time_t Log::GetNextDay(const struct tm &sys_time)
+{
+    struct tm next_day = sys_time;
+    next_day.tm_mday += 1;
+    next_day.tm_hour = 0;
+    next_day.tm_min = 0;
+    next_day.tm_sec = 0;
+    next_day.tm_isdst = -1;
+    return mktime(&next_day);
+}
+
+void Log::GetFileName(char *file_name, const struct tm &sys_time, int index)
+{
+    if(index == 0)
+    {
+        snprintf(file_name, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s", m_path, sys_time.tm_year + 1900, sys_time.tm_mon + 1, sys_time.tm_mday, m_suffix);
+    }
+    else
+    {
+        snprintf(file_name, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d-%d%s", m_path, sys_time.tm_year + 1900, sys_time.tm_mon + 1, sys_time.tm_mday, index, m_suffix);
+    }
+}
+
+//mmap模式下切换只是换上后台预建好的文件, 随即让后台线程预建下一个
+//mmap文件建不出来(磁盘满, 映射失败等)时不再用mmap, 退回stdio写同一个文件, 错误只报告这一次
+void Log::OpenFileLocked(const struct tm &sys_time, int index)
+{
+    char file_name[LOG_NAME_LEN] = {0};
+    GetFileName(file_name, sys_time, index);
+    int open_error = 0;
+    if(m_segment && !m_segment->Open(file_name))
+    {
+        open_error = errno;
+        m_segment.reset();
+    }
+
+    if(m_segment)
+    {
+        PrepareNextLocked(time(nullptr), index);
+    }
+    else
+    {
+        m_file = fopen(file_name, "a");
+        if(!m_file)
+        {
+            mkdir(m_path, 0777);
+            m_file = fopen(file_name, "a");
+        }
+
+        assert(m_file != nullptr);
+    }
+
+    //二进制文件各自带上完整的格式串字典, 切分后的每个文件都能单独解码
+    if(m_binary)
+    {
+        char header[16];
+        OutputLocked(header, LogBinary::EncodeHeader(header, sizeof(header)));
+        for(LogSite *site : m_sites)
+        {
+            WriteSiteLocked(*site);
+        }
+    }
+
+    if(open_error != 0)
+    {
+        char text[LOG_NAME_LEN + 128];
+        int n = snprintf(text, sizeof(text), "mmap log file %s open failed: %s, writing through stdio", file_name, strerror(open_error));
+        WriteErrorLocked(text, std::min(static_cast<size_t>(std::max(n, 0)), sizeof(text) - 1));
+    }
+}
+
+//临近零点时预建次日的第一个文件, 跨天切换和按大小切分一样不在锁内创建文件; 否则预建当天的下一个文件
+void Log::PrepareNextLocked(time_t now_time, int index)
+{
+    char file_name[LOG_NAME_LEN] = {0};
+    struct tm sys_time;
+    m_next_day_prepared = now_time >= m_next_day - PREPARE_DAY_AHEAD;
+    if(m_next_day_prepared)
+    {
+        localtime_r(&m_next_day, &sys_time);
+        GetFileName(file_name, sys_time, 0);
+    }
+    else
+    {
+        localtime_r(&now_time, &sys_time);
+        GetFileName(file_name, sys_time, index + 1);
+    }
+
+    m_segment->Prepare(file_name);
+}
+
+//mmap模式下由LogSegmentWriter::Open换下旧文件, 不在这里关闭
+void Log::SwitchFileLocked(const struct tm &sys_time, int index)
+{
+    if(!m_segment)
+    {
+        CloseFileLocked();
+    }
+
+    OpenFileLocked(sys_time, index);
+}
+
+void Log::CloseFileLocked()
+{
+    if(m_segment)
+    {
+        m_segment->Close();
+    }
+
+    if(m_file)
+    {
+        fflush(m_file);
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
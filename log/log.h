@@ -5,14 +5,42 @@
 #ifndef TINY_WEBSERVER_C11_LOG_H
 #define TINY_WEBSERVER_C11_LOG_H
 
+#include <algorithm>
 #include <mutex>
 #include <string>
 #include <thread>
 #include "../buffer/buffer.h"
 #include "blockqueue.h"
+#include "mpmcqueue.h"
+#include "logring.h"
+#include "logtime.h"
+#include "logformat.h"
+#include "logbinary.h"
+#include "logsegment.h"
+#include <atomic>
+#include <stdarg.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <condition_variable>
+#include <memory>
+#include <vector>
 #include <assert.h>
 
+//一处LOG_*调用点的静态信息, 首次执行时向Log登记并分配编号; 二进制模式下事件记录只带编号和参数
+struct LogSite
+{
+    LogSite(int level, const char *format, const char *file, int line);
+
+    int level;
+    const char *format;
+    const char *file;
+    int line;
+    uint32_t id;
+    std::atomic<uint64_t> next_ns;                      //限流用: 令牌桶的理论到达时间(GCRA)
+    std::atomic<uint64_t> suppressed;                   //被限流丢弃且尚未报告的条数
+    std::atomic<bool> text;                             //格式串记录超长写不进字典, 二进制模式下改写格式化好的文本记录
+};
+
 class Log
 {
 public:
@@ -24,54 +52,262 @@ public:
         LL_ERROR,
     };
 
-    void Init(int level = LL_DEBUG, const char *path = "./log", const char *suffix = ".log", int max_queue_capacity = 1024);
-    void Write(int level, const char *format, ...);
+    enum ASYNC_MODE
+    {
+        AM_BLOCK_DEQUE = 0,                             //每行一个std::string, 经BlockDeque交给写线程
+        AM_RING,                                        //直接格式化进无锁环形队列的预分配槽位, 写线程按批取出
+        AM_THREAD_BUFFER,                               //每个线程写自己的大缓冲区, 写满后整块交换给写线程
+        AM_MPMC_QUEUE,                                  //同AM_BLOCK_DEQUE, 队列换成无锁的MpmcQueue
+    };
+
+    enum FLUSH_POLICY
+    {
+        FP_NONE = 0,                                    //只由写线程和缓冲区决定何时落盘
+        FP_ON_ERROR,                                    //LL_ERROR及以上立即刷新
+        FP_ALWAYS,                                      //每行都刷新
+    };
+
+    //异步队列满时的处理
+    enum OVERFLOW_POLICY
+    {
+        OP_WRITE_THROUGH = 0,                           //当前线程加锁同步写文件(AM_THREAD_BUFFER下等待)
+        OP_BLOCK,                                       //等待写线程腾出空间
+        OP_DROP_NEWEST,                                 //丢弃当前这条
+        OP_DROP_OLDEST,                                 //丢弃最早排队的; AM_RING只有写线程能出队, 退化为丢弃当前这条
+        OP_SAMPLE,                                      //每N条保留一条(等待), 其余丢弃
+    };
+
+    struct OverflowStats
+    {
+        uint64_t written_through;
+        uint64_t blocked;
+        uint64_t dropped_newest;
+        uint64_t dropped_oldest;
+        uint64_t sampled_out;
+        uint64_t rate_limited;                          //被调用点限流丢弃的条数
+    };
+
+    //max_queue_capacity为0时同步写文件; binary为true时写二进制日志, 由logdecoder还原成文本
+    void Init(int level = LL_DEBUG, const char *path = "./log", const char *suffix = ".log", int max_queue_capacity = 1024,
+              ASYNC_MODE async_mode = AM_BLOCK_DEQUE, bool binary = false);
+    void Write(int level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    //类型安全的写入, "{}"为占位符, 按参数类型格式化而不解析printf格式; 一般经LOG_*宏调用
+    template<class... Args>
+    void Print(int level, const char *format, const Args &...args)
+    {
+        auto body = [&](char *dst, size_t size){ return LogFormat::Format(dst, size, format, args...); };
+        WriteBody(level, &InvokeBody<decltype(body)>, &body);
+    }
+
+    //二进制模式下不做格式化, 只把调用点编号和参数原始值编码进记录
+    template<class... Args>
+    void Print(LogSite &site, const Args &...args)
+    {
+        if(m_rate_interval_ns.load(std::memory_order_relaxed) > 0 && !AdmitSite(site))
+        {
+            return;
+        }
+
+        if(!m_binary || site.text.load(std::memory_order_relaxed))
+        {
+            Print(site.level, site.format, args...);
+            return;
+        }
+
+        auto record = [&](char *dst, size_t size){ return LogBinary::EncodeEvent(dst, size, site.id, args...); };
+        EmitRecord(site.level, &InvokeBody<decltype(record)>, &record);
+    }
+
     static Log *Instance();
     static void FlushLogThread();
     void Flush();
     int GetLevel();
     void SetLevel(int level);
     bool IsOpen(){return is_open;}
+    bool IsEnabled(int level){return is_open && level >= m_level.load(std::memory_order_relaxed);}
+    void SetFlushPolicy(FLUSH_POLICY policy);
+    void SetFlushInterval(int interval_ms);             //AM_THREAD_BUFFER模式下定时收集未写满的缓冲区
+    void SetMicroseconds(bool enable);                  //时间前缀是否带微秒
+    void RegisterSite(LogSite *site);
+    //在Init之前调用: segment_size大于0时改用mmap写固定大小的预分配文件, 写满即切换; sync_interval_ms为msync周期, 0表示交给内核
+    void SetMmapOutput(size_t segment_size, int sync_interval_ms = 1000);
+    //sample_rate只用于OP_SAMPLE
+    void SetOverflowPolicy(OVERFLOW_POLICY policy, int sample_rate = 100);
+    //每个LOG_*调用点每秒最多per_second条, 允许burst条突发; 恢复放行时, 写线程定时或Flush时补一行"N messages suppressed"; per_second为0时关闭
+    void SetRateLimit(int per_second, int burst = 10);
+    OverflowStats GetOverflowStats();
+    uint64_t GetWrittenLines();                         //已交给文件的总行数, 可用来判断写线程是否追上
 
 private:
     Log();
     virtual ~Log();
+    //正文格式化回调: 向dst写入不超过size字节, 返回写入长度
+    typedef size_t (*BodyFormatter)(char *dst, size_t size, void *context);
+
+    template<class F>
+    static size_t InvokeBody(char *dst, size_t size, void *context)
+    {
+        return (*static_cast<F *>(context))(dst, size);
+    }
+
+    void WriteBody(int level, BodyFormatter formatter, void *context);
+    void EmitRecord(int level, BodyFormatter encoder, void *context);  //encoder写出整条记录: 文本行或二进制记录
+    static size_t EncodeLine(char *dst, size_t size, void *context);
+    static size_t EncodeTextRecord(char *dst, size_t size, void *context);
+    void FlushByPolicy(int level);
+
+    enum OVERFLOW_ACTION
+    {
+        OA_WRITE_THROUGH = 0,
+        OA_WAIT,
+        OA_DROP,
+        OA_DROP_OLDEST,
+    };
+
+    OVERFLOW_ACTION OnOverflow(bool can_write_through = true);     //按策略决定并计数, OA_DROP_OLDEST由调用方在丢弃后计数
+    bool AdmitSite(LogSite &site);
     void AsyncWrite();
-    void AppendLogLevelTitle(int level);
+    //AM_BLOCK_DEQUE与AM_MPMC_QUEUE共用, Queue为BlockDeque或MpmcQueue
+    template<class Queue>
+    OVERFLOW_ACTION EnqueueLineLocked(Queue &queue, std::string &line);    //返回放开m_mutex后还要做的处理
+    template<class Queue>
+    void QueueWrite(Queue &queue);
+    template<class Queue>
+    void CloseQueue(Queue &queue);
+    void RingWrite();
+    void ThreadBufferWrite();
+    size_t FormatLine(char *dst, size_t size, int level, BodyFormatter formatter, void *context);
+    void WriteLocked(const char *data, size_t len, int lines);     //调用方需持有m_mutex
+    void WriteBatchLocked(const struct iovec *iov, int count, int lines);
+    void CheckRotateLocked(size_t len);                 //len为接下来要写入的长度, mmap文件放不下时切换
+    void OpenFileLocked(const struct tm &sys_time, int index);
+    void SwitchFileLocked(const struct tm &sys_time, int index);
+    void CloseFileLocked();
+    void OutputLocked(const char *data, size_t len);
+    void GetFileName(char *file_name, const struct tm &sys_time, int index);
+    void WriteSiteLocked(LogSite &site);
+    size_t FormatText(char *record, int level, const char *text, size_t len);
+    void WriteErrorLocked(const char *text, size_t len);
+    void ReportSuppressed(bool force);                  //写出各调用点积压的限流条数, force为false时每SUPPRESS_REPORT_MS最多一次
+    void PrepareNextLocked(time_t now_time, int index);     //让mmap后台线程预建下一个要切换到的文件
+    static time_t GetNextDay(const struct tm &sys_time);
+
+    struct LogChunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t len;
+        int lines;
+    };
+
+    //线程私有的双缓冲: current写满后交给写线程, spare顶上, 锁只在写线程定时收集时才有竞争
+    struct ThreadBuffer
+    {
+        std::mutex mtx;
+        LogChunk current;
+        std::unique_ptr<char[]> spare;
+        bool closed = false;                            //所属线程已退出, 写完剩余内容后移除
+    };
+
+    ThreadBuffer *GetThreadBuffer();                    //写线程关闭后新的线程得到nullptr
+    void HandOffLocked(ThreadBuffer &buffer);           //调用方需持有buffer.mtx和m_chunk_mutex
+    std::unique_ptr<char[]> AcquireChunkLocked();
 
 private:
     static const int LOG_PATH_LEN = 256;
     static const int LOG_NAME_LEN = 256;
     static const int LOG_MAX_LINES = 50000;
+    static const size_t MAX_LINE_LEN = LogRing::DATA_SIZE;  //含换行, 超长的日志行被截断
+    static const size_t WRITE_BATCH = 256;              //写线程每批最多取出的记录数
+    static const int RING_WAIT_MS = 100;
+    static constexpr int SUPPRESS_REPORT_MS = 1000;
+    static const time_t PREPARE_DAY_AHEAD = 60;         //零点前多少秒开始预建次日的文件
+    static const size_t THREAD_BUFFER_SIZE = 64 * 1024;
+    static const size_t MAX_PENDING_CHUNKS = 256;       //写线程落后时最多积压的缓冲区数, 超过后生产者等待
+    static const size_t MAX_FREE_CHUNKS = 64;
 
     const char* m_path;
     const char* m_suffix;
     int m_max_lines;
-    int m_line_count;
-    int m_today;
-    int m_level;
+    int m_line_count;                                   //当前文件已写入的行数
+    int m_file_index;                                   //当天第几个文件, 每LOG_MAX_LINES行或mmap文件写满时切换
+    time_t m_next_day;                                  //次日零点, 到点后按天切分文件
+    bool m_next_day_prepared;                           //已让后台线程预建次日的文件
+    std::atomic<int> m_level;
+    std::atomic<bool> m_microseconds;
+    std::atomic<int> m_flush_policy;
     bool is_open;
     bool is_async;
+    bool m_binary;
+    ASYNC_MODE m_async_mode;
     Buffer m_buff;
     FILE *m_file;
+    std::unique_ptr<LogSegmentWriter> m_segment;        //非空时不用m_file, 经mmap写入
+    size_t m_segment_size;
+    int m_sync_interval_ms;
     std::unique_ptr<BlockDeque<std::string>> m_block_deque;
+    std::unique_ptr<MpmcQueue<std::string>> m_mpmc_queue;
+    std::unique_ptr<LogRing> m_ring;
+    std::string m_batch;                                //写线程合并一批记录后一次写入
     std::unique_ptr<std::thread> m_write_thread;
     std::mutex m_mutex;
+
+    std::mutex m_chunk_mutex;                           //保护下面的线程缓冲区登记表与待写/空闲缓冲区
+    std::condition_variable m_chunk_cond;
+    std::condition_variable m_chunk_space;
+    std::vector<std::shared_ptr<ThreadBuffer>> m_thread_buffers;
+    std::vector<LogChunk> m_full_chunks;
+    std::vector<std::unique_ptr<char[]>> m_free_chunks;
+    std::atomic<bool> m_chunk_close;                    //写线程关闭; 生产者在自己缓冲区的锁内读取, 不加m_chunk_mutex
+    bool m_collect_request;                             //Flush要求立即收集各线程的缓冲区
+    int m_flush_interval_ms;
+    std::vector<LogSite *> m_sites;              //已登记的调用点, 受m_mutex保护; 下标+1即编号
+
+    std::atomic<int> m_overflow_policy;
+    std::atomic<int> m_sample_rate;
+    std::atomic<uint64_t> m_sample_count;
+    std::atomic<uint64_t> m_rate_interval_ns;           //两条之间的最小间隔, 0表示不限流
+    std::atomic<uint64_t> m_rate_burst_ns;
+    std::atomic<uint64_t> m_written_through;
+    std::atomic<uint64_t> m_blocked;
+    std::atomic<uint64_t> m_dropped_newest;
+    std::atomic<uint64_t> m_dropped_oldest;
+    std::atomic<uint64_t> m_sampled_out;
+    std::atomic<uint64_t> m_rate_limited;
+    std::atomic<uint64_t> m_rate_reported;              //已补报到的m_rate_limited, 相等时没有待报告的限流
+    std::chrono::steady_clock::time_point m_next_report;    //受m_mutex保护
+    std::atomic<uint64_t> m_written_lines;
 };
 
+inline LogSite::LogSite(int level, const char *format, const char *file, int line):level(level), format(format), file(file), line(line), id(0),
+    next_ns(0), suppressed(0), text(false)
+{
+    Log::Instance()->RegisterSite(this);
+}
+
+//低于LOG_MIN_LEVEL的日志在编译期整条去掉; 格式串中的"{}"个数必须与参数个数一致, 否则编译失败
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
 #define LOG_BASE(level, format, ...) \
     do{\
-        Log *log = Log::Instance();  \
-        if(log->IsOpen() && log->GetLevel <= level) \
+        if constexpr((level) >= LOG_MIN_LEVEL) \
         {                            \
-            log->Write(level, format, ##__VA_ARGS__); \
-            log->Flush();            \
+            static_assert(LogFormat::CountPlaceholders(format) == decltype(LogFormat::CountArgs(__VA_ARGS__))::value, \
+                          "log format placeholders do not match arguments"); \
+            Log *log = Log::Instance();  \
+            if(log->IsEnabled(level)) \
+            {                        \
+                static LogSite log_site(level, format, __FILE__, __LINE__); \
+                log->Print(log_site, ##__VA_ARGS__); \
+            }                        \
         }\
-    }while(0);
+    }while(0)
 
-#define LOG_DEBUG(format, ...) do{LOG_BASE(0, format, ##__VA_ARGS__)} while(0);
-#define LOG_INFO(format, ...) do{LOG_BASE(1, format, ##__VA_ARGS__)} while(0);
-#define LOG_WARN(format, ...) do{LOG_BASE(2, format, ##__VA_ARGS__)} while(0);
-#define LOG_ERROR(format, ...) do{LOG_BASE(3, format, ##__VA_ARGS__)} while(0);
+#define LOG_DEBUG(format, ...) LOG_BASE(Log::LL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_BASE(Log::LL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_BASE(Log::LL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_BASE(Log::LL_ERROR, format, ##__VA_ARGS__)
 
 #endif //TINY_WEBSERVER_C11_LOG_H
@@ -0,0 +1,241 @@
+//
+// Created by ciaowhen on 2023/5/20.
+//
+
+#include "logbinary.h"
+
+namespace
+{
+    const char MAGIC[] = "TWLOG";
+
+    bool ReadVarint(const char *&pos, const char *end, uint64_t &value)
+    {
+        value = 0;
+        for(int shift = 0; shift < 64 && pos < end; shift += 7)
+        {
+            uint8_t byte = static_cast<uint8_t>(*pos++);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if(!(byte & 0x80))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool ReadRaw(const char *&pos, const char *end, void *dst, size_t len)
+    {
+        if(static_cast<size_t>(end - pos) < len)
+        {
+            return false;
+        }
+
+        memcpy(dst, pos, len);
+        pos += len;
+        return true;
+    }
+
+    bool ReadCString(const char *&pos, const char *end, std::string &value)
+    {
+        const char *stop = static_cast<const char *>(memchr(pos, '\0', static_cast<size_t>(end - pos)));
+        if(!stop)
+        {
+            return false;
+        }
+
+        value.assign(pos, stop);
+        pos = stop + 1;
+        return true;
+    }
+
+    bool ReadArg(const char *&pos, const char *end, LogBinary::Arg &arg)
+    {
+        uint64_t value = 0;
+        arg.tag = static_cast<uint8_t>(*pos++);
+        switch(arg.tag)
+        {
+            case LogBinary::AT_INT:
+                if(!ReadVarint(pos, end, value))
+                {
+                    return false;
+                }
+                arg.i = static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+                return true;
+            case LogBinary::AT_UINT:
+                return ReadVarint(pos, end, arg.u);
+            case LogBinary::AT_DOUBLE:
+                return ReadRaw(pos, end, &arg.d, sizeof(arg.d));
+            case LogBinary::AT_BOOL:
+            case LogBinary::AT_CHAR:
+                if(pos >= end)
+                {
+                    return false;
+                }
+                arg.b = *pos != 0;
+                arg.c = *pos++;
+                return true;
+            case LogBinary::AT_STRING:
+                if(!ReadVarint(pos, end, value) || static_cast<uint64_t>(end - pos) < value)
+                {
+                    return false;
+                }
+                arg.s.assign(pos, value);
+                pos += value;
+                return true;
+            case LogBinary::AT_POINTER:
+                if(!ReadVarint(pos, end, value))
+                {
+                    return false;
+                }
+                arg.p = reinterpret_cast<const void *>(static_cast<uintptr_t>(value));
+                return true;
+            default:
+                return false;
+        }
+    }
+}
+
+size_t LogBinary::EncodeHeader(char *dst, size_t size)
+{
+    LogBinaryWriter writer(dst, size);
+    BeginRecord(writer, RT_HEADER);
+    writer.PutRaw(MAGIC, sizeof(MAGIC));
+    writer.PutByte(VERSION);
+    return writer.IsOverflow() ? 0 : EndRecord(dst, writer);
+}
+
+size_t LogBinary::EncodeFormat(char *dst, size_t size, uint32_t id, int level, const char *file, int line, const char *format)
+{
+    LogBinaryWriter writer(dst, size);
+    BeginRecord(writer, RT_FORMAT);
+    writer.PutVarint(id);
+    writer.PutByte(static_cast<uint8_t>(level));
+    writer.PutVarint(static_cast<uint64_t>(line));
+    writer.PutRaw(file, strlen(file) + 1);
+    writer.PutRaw(format, strlen(format) + 1);
+    return writer.IsOverflow() ? 0 : EndRecord(dst, writer);
+}
+
+size_t LogBinary::EncodeText(char *dst, size_t size, int level, const char *text, size_t len)
+{
+    LogBinaryWriter writer(dst, size);
+    BeginRecord(writer, RT_TEXT);
+    writer.PutByte(static_cast<uint8_t>(level));
+    uint64_t now = GetNowNs();
+    writer.PutRaw(&now, sizeof(now));
+    if(writer.GetLength() >= size)
+    {
+        return 0;
+    }
+
+    writer.PutRaw(text, std::min(len, size - writer.GetLength()));
+    return EndRecord(dst, writer);
+}
+
+bool LogBinary::Decode(const char *&pos, const char *end, Record &record)
+{
+    uint16_t len = 0;
+    if(static_cast<size_t>(end - pos) < RECORD_HEAD_LEN)
+    {
+        return false;
+    }
+
+    memcpy(&len, pos, sizeof(len));
+    if(len < RECORD_HEAD_LEN || static_cast<size_t>(end - pos) < len)
+    {
+        return false;
+    }
+
+    const char *cur = pos + 2;
+    const char *stop = pos + len;
+    uint64_t value = 0;
+    record.type = static_cast<uint8_t>(*cur++);
+    record.args.clear();
+    switch(record.type)
+    {
+        case RT_HEADER:
+        {
+            std::string magic;
+            if(!ReadCString(cur, stop, magic) || magic != MAGIC || cur >= stop || static_cast<uint8_t>(*cur) > VERSION)
+            {
+                return false;
+            }
+            break;
+        }
+        case RT_FORMAT:
+        {
+            if(!ReadVarint(cur, stop, value) || cur >= stop)
+            {
+                return false;
+            }
+            record.id = static_cast<uint32_t>(value);
+            record.level = static_cast<uint8_t>(*cur++);
+            if(!ReadVarint(cur, stop, value) || !ReadCString(cur, stop, record.file) || !ReadCString(cur, stop, record.format))
+            {
+                return false;
+            }
+            record.line = static_cast<int>(value);
+            break;
+        }
+        case RT_EVENT:
+        {
+            if(!ReadVarint(cur, stop, value) || !ReadRaw(cur, stop, &record.timestamp_ns, sizeof(record.timestamp_ns)))
+            {
+                return false;
+            }
+            record.id = static_cast<uint32_t>(value);
+            while(cur < stop)
+            {
+                record.args.emplace_back();
+                if(!ReadArg(cur, stop, record.args.back()))
+                {
+                    return false;
+                }
+            }
+            break;
+        }
+        case RT_TEXT:
+        {
+            if(cur >= stop)
+            {
+                return false;
+            }
+            record.level = static_cast<uint8_t>(*cur++);
+            if(!ReadRaw(cur, stop, &record.timestamp_ns, sizeof(record.timestamp_ns)))
+            {
+                return false;
+            }
+            record.format.assign(cur, stop);
+            break;
+        }
+        default:
+            return false;
+    }
+
+    pos = stop;
+    return true;
+}
+
+size_t LogBinary::Render(char *dst, size_t size, const std::string &format, const std::vector<Arg> &args)
+{
+    std::vector<LogFormat::ArgRef> refs;
+    refs.reserve(args.size());
+    for(const Arg &arg : args)
+    {
+        switch(arg.tag)
+        {
+            case AT_INT:        refs.emplace_back(arg.i); break;
+            case AT_UINT:       refs.emplace_back(arg.u); break;
+            case AT_DOUBLE:     refs.emplace_back(arg.d); break;
+            case AT_BOOL:       refs.emplace_back(arg.b); break;
+            case AT_CHAR:       refs.emplace_back(arg.c); break;
+            case AT_STRING:     refs.emplace_back(arg.s); break;
+            default:            refs.emplace_back(arg.p); break;
+        }
+    }
+
+    LogOutput out(dst, size);
+    LogFormat::FormatArgs(out, format.c_str(), refs.data(), refs.size());
+    return out.GetLength();
+}
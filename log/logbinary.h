@@ -0,0 +1,380 @@
+//
+// Created by ciaowhen on 2023/5/20.
+//
+
+#ifndef ADVANCECODE_LOGBINARY_H
+#define ADVANCECODE_LOGBINARY_H
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "logformat.h"
+
+//二进制日志: 热路径只记录格式串编号, 时间戳和参数的原始字节, 文本格式化由logdecoder离线完成
+//每条记录为 [u16 总长度][u8 类型][内容], 整数为小端; 变长整数用LEB128, 有符号数先做zigzag
+//  RT_HEADER  "TWLOG\0" + u8 版本, 每次打开文件时写入
+//  RT_FORMAT  varint 编号, u8 级别, varint 行号, 文件名\0, 格式串\0
+//  RT_EVENT   varint 编号, u64 纳秒时间戳, 参数若干: u8 标签 + 值
+//  RT_TEXT    u8 级别, u64 纳秒时间戳, 已格式化的正文(printf风格的Write)
+class LogBinaryWriter
+{
+public:
+    LogBinaryWriter(char *begin, size_t size):m_begin(begin), m_pos(begin), m_end(begin + size), m_overflow(false), m_truncated(false) {}
+
+    void PutByte(uint8_t value)
+    {
+        if(m_pos < m_end)
+        {
+            *m_pos++ = static_cast<char>(value);
+        }
+        else
+        {
+            m_overflow = true;
+        }
+    }
+
+    void PutVarint(uint64_t value)
+    {
+        while(value >= 0x80)
+        {
+            PutByte(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+
+        PutByte(static_cast<uint8_t>(value));
+    }
+
+    void PutRaw(const void *data, size_t len)
+    {
+        if(static_cast<size_t>(m_end - m_pos) < len)
+        {
+            m_overflow = true;
+            return;
+        }
+
+        memcpy(m_pos, data, len);
+        m_pos += len;
+    }
+
+    //放不下时截到剩余空间, 末尾换成"..."并标记截断, 之后的参数不再写入
+    void PutString(const char *data, size_t len)
+    {
+        size_t room = GetRoom();
+        if(GetVarintSize(len) + len <= room)
+        {
+            PutVarint(len);
+            PutRaw(data, len);
+            return;
+        }
+
+        size_t clipped = room > GetVarintSize(room) ? room - GetVarintSize(room) : 0;
+        while(clipped > 0 && GetVarintSize(clipped) + clipped > room)
+        {
+            --clipped;
+        }
+
+        if(clipped < 3)
+        {
+            m_overflow = true;
+            return;
+        }
+
+        PutVarint(clipped);
+        PutRaw(data, clipped - 3);
+        PutRaw("...", 3);
+        m_truncated = true;
+    }
+
+    static size_t GetVarintSize(uint64_t value)
+    {
+        size_t size = 1;
+        while(value >= 0x80)
+        {
+            value >>= 7;
+            ++size;
+        }
+
+        return size;
+    }
+
+    char *GetPos() const { return m_pos; }
+    size_t GetLength() const { return static_cast<size_t>(m_pos - m_begin); }
+    size_t GetRoom() const { return static_cast<size_t>(m_end - m_pos); }
+    bool IsOverflow() const { return m_overflow; }
+    bool IsTruncated() const { return m_truncated; }
+    void SetTruncated() { m_truncated = true; }
+
+    //放不下的参数整个丢弃, 回到写它之前的位置
+    void Rollback(char *pos)
+    {
+        m_pos = pos;
+        m_overflow = false;
+    }
+
+private:
+    char *m_begin;
+    char *m_pos;
+    char *m_end;
+    bool m_overflow;
+    bool m_truncated;                                   //已有参数被截断或丢弃, 后面的参数不再写, 避免与占位符错位
+};
+
+class LogBinary
+{
+public:
+    enum RECORD_TYPE
+    {
+        RT_HEADER = 0,
+        RT_FORMAT,
+        RT_EVENT,
+        RT_TEXT,
+    };
+
+    enum ARG_TAG
+    {
+        AT_INT = 0,
+        AT_UINT,
+        AT_DOUBLE,
+        AT_BOOL,
+        AT_CHAR,
+        AT_STRING,
+        AT_POINTER,
+    };
+
+    static const uint8_t VERSION = 1;
+    static const size_t RECORD_HEAD_LEN = 3;
+
+    static size_t EncodeHeader(char *dst, size_t size);
+    static size_t EncodeFormat(char *dst, size_t size, uint32_t id, int level, const char *file, int line, const char *format);
+    static size_t EncodeText(char *dst, size_t size, int level, const char *text, size_t len);
+
+    template<class... Args>
+    static size_t EncodeEvent(char *dst, size_t size, uint32_t id, const Args &...args)
+    {
+        LogBinaryWriter writer(dst, size);
+        BeginRecord(writer, RT_EVENT);
+        writer.PutVarint(id);
+        uint64_t now = GetNowNs();
+        writer.PutRaw(&now, sizeof(now));
+        (EncodeArg(writer, args), ...);
+        return EndRecord(dst, writer);
+    }
+
+    struct Arg
+    {
+        uint8_t tag = AT_INT;
+        int64_t i = 0;
+        uint64_t u = 0;
+        double d = 0;
+        bool b = false;
+        char c = 0;
+        std::string s;
+        const void *p = nullptr;
+    };
+
+    struct Record
+    {
+        uint8_t type = RT_HEADER;
+        uint32_t id = 0;
+        int level = 0;
+        int line = 0;
+        uint64_t timestamp_ns = 0;
+        std::string file;
+        std::string format;                             //RT_TEXT时为正文
+        std::vector<Arg> args;
+    };
+
+    //从[pos, end)解出一条记录并前移pos; 数据不完整或损坏时返回false
+    static bool Decode(const char *&pos, const char *end, Record &record);
+
+    //按格式串把解出的参数格式化为正文
+    static size_t Render(char *dst, size_t size, const std::string &format, const std::vector<Arg> &args);
+
+    static uint64_t GetNowNs()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        return static_cast<uint64_t>(now.tv_sec) * 1000000000ull + static_cast<uint64_t>(now.tv_nsec);
+    }
+
+    static void BeginRecord(LogBinaryWriter &writer, RECORD_TYPE type)
+    {
+        writer.PutRaw("\0\0", 2);
+        writer.PutByte(type);
+    }
+
+    static size_t EndRecord(char *dst, LogBinaryWriter &writer)
+    {
+        uint16_t len = static_cast<uint16_t>(writer.GetLength());
+        memcpy(dst, &len, sizeof(len));
+        return len;
+    }
+
+private:
+    template<class T>
+    static void EncodeArg(LogBinaryWriter &writer, const T &value);
+};
+
+//按类型编码一个参数; 没有专门编码的类型在调用处用LogArgFormatter格式化成字符串
+template<class T, class Enable = void>
+struct LogArgEncoder
+{
+    static void Encode(LogBinaryWriter &writer, const T &value)
+    {
+        char text[256];
+        size_t len = LogFormat::Format(text, sizeof(text), "{}", value);
+        writer.PutByte(LogBinary::AT_STRING);
+        writer.PutString(text, len);
+    }
+};
+
+template<>
+struct LogArgEncoder<bool>
+{
+    static void Encode(LogBinaryWriter &writer, bool value)
+    {
+        writer.PutByte(LogBinary::AT_BOOL);
+        writer.PutByte(value ? 1 : 0);
+    }
+};
+
+template<>
+struct LogArgEncoder<char>
+{
+    static void Encode(LogBinaryWriter &writer, char value)
+    {
+        writer.PutByte(LogBinary::AT_CHAR);
+        writer.PutByte(static_cast<uint8_t>(value));
+    }
+};
+
+template<class T>
+struct LogArgEncoder<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value
+                                                && !std::is_same<T, char>::value && !std::is_same<T, bool>::value>::type>
+{
+    static void Encode(LogBinaryWriter &writer, T value)
+    {
+        int64_t wide = value;
+        writer.PutByte(LogBinary::AT_INT);
+        writer.PutVarint((static_cast<uint64_t>(wide) << 1) ^ static_cast<uint64_t>(wide >> 63));
+    }
+};
+
+template<class T>
+struct LogArgEncoder<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+                                                && !std::is_same<T, char>::value && !std::is_same<T, bool>::value>::type>
+{
+    static void Encode(LogBinaryWriter &writer, T value)
+    {
+        writer.PutByte(LogBinary::AT_UINT);
+        writer.PutVarint(value);
+    }
+};
+
+template<class T>
+struct LogArgEncoder<T, typename std::enable_if<std::is_enum<T>::value>::type>
+{
+    static void Encode(LogBinaryWriter &writer, T value)
+    {
+        typedef typename std::underlying_type<T>::type Underlying;
+        LogArgEncoder<Underlying>::Encode(writer, static_cast<Underlying>(value));
+    }
+};
+
+template<class T>
+struct LogArgEncoder<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static void Encode(LogBinaryWriter &writer, T value)
+    {
+        double wide = static_cast<double>(value);
+        writer.PutByte(LogBinary::AT_DOUBLE);
+        writer.PutRaw(&wide, sizeof(wide));
+    }
+};
+
+template<>
+struct LogArgEncoder<const char *>
+{
+    static void Encode(LogBinaryWriter &writer, const char *value)
+    {
+        writer.PutByte(LogBinary::AT_STRING);
+        value ? writer.PutString(value, strlen(value)) : writer.PutString("(null)", 6);
+    }
+};
+
+template<>
+struct LogArgEncoder<char *> : LogArgEncoder<const char *> {};
+
+template<size_t N>
+struct LogArgEncoder<char[N]>
+{
+    static void Encode(LogBinaryWriter &writer, const char (&value)[N])
+    {
+        writer.PutByte(LogBinary::AT_STRING);
+        writer.PutString(value, strnlen(value, N));
+    }
+};
+
+template<>
+struct LogArgEncoder<std::string>
+{
+    static void Encode(LogBinaryWriter &writer, const std::string &value)
+    {
+        writer.PutByte(LogBinary::AT_STRING);
+        writer.PutString(value.data(), value.size());
+    }
+};
+
+template<>
+struct LogArgEncoder<std::string_view>
+{
+    static void Encode(LogBinaryWriter &writer, std::string_view value)
+    {
+        writer.PutByte(LogBinary::AT_STRING);
+        writer.PutString(value.data(), value.size());
+    }
+};
+
+template<class T>
+struct LogArgEncoder<T *, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+    static void Encode(LogBinaryWriter &writer, const T *value)
+    {
+        writer.PutByte(LogBinary::AT_POINTER);
+        writer.PutVarint(reinterpret_cast<uintptr_t>(value));
+    }
+};
+
+//放不下的参数整个丢弃, 换成截断标记(放得下时), 之后的参数也不再写入, 解码时剩下的占位符原样输出
+template<class T>
+void LogBinary::EncodeArg(LogBinaryWriter &writer, const T &value)
+{
+    if(writer.IsTruncated())
+    {
+        return;
+    }
+
+    char *mark = writer.GetPos();
+    LogArgEncoder<T>::Encode(writer, value);
+    if(!writer.IsOverflow())
+    {
+        return;
+    }
+
+    writer.Rollback(mark);
+    static const char TRUNCATED_MARK[] = "<truncated>";
+    const size_t mark_len = sizeof(TRUNCATED_MARK) - 1;
+    if(writer.GetRoom() >= 1 + LogBinaryWriter::GetVarintSize(mark_len) + mark_len)
+    {
+        writer.PutByte(AT_STRING);
+        writer.PutString(TRUNCATED_MARK, mark_len);
+    }
+
+    writer.SetTruncated();
+}
+
+#endif //ADVANCECODE_LOGBINARY_H
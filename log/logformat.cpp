@@ -0,0 +1,113 @@
+//
+// Created by ciaowhen on 2023/5/19.
+//
+
+#include "logformat.h"
+#include <charconv>
+
+void LogOutput::AppendSigned(int64_t value)
+{
+    if(value < 0)
+    {
+        Put('-');
+        AppendUnsigned(0 - static_cast<uint64_t>(value));
+        return;
+    }
+
+    AppendUnsigned(static_cast<uint64_t>(value));
+}
+
+//两位一组查表, 从低位往高位写进临时区
+void LogOutput::AppendUnsigned(uint64_t value)
+{
+    static const char DIGITS[] =
+        "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+        "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    char temp[20];
+    char *pos = temp + sizeof(temp);
+    while(value >= 100)
+    {
+        size_t index = static_cast<size_t>(value % 100) * 2;
+        value /= 100;
+        *--pos = DIGITS[index + 1];
+        *--pos = DIGITS[index];
+    }
+
+    if(value >= 10)
+    {
+        size_t index = static_cast<size_t>(value) * 2;
+        *--pos = DIGITS[index + 1];
+        *--pos = DIGITS[index];
+    }
+    else
+    {
+        *--pos = static_cast<char>('0' + value);
+    }
+
+    Append(pos, static_cast<size_t>(temp + sizeof(temp) - pos));
+}
+
+void LogOutput::AppendHex(uint64_t value)
+{
+    static const char HEX[] = "0123456789abcdef";
+    char temp[18];
+    char *pos = temp + sizeof(temp);
+    do
+    {
+        *--pos = HEX[value & 0xf];
+        value >>= 4;
+    } while(value);
+
+    *--pos = 'x';
+    *--pos = '0';
+    Append(pos, static_cast<size_t>(temp + sizeof(temp) - pos));
+}
+
+//最短的可精确还原的十进制表示
+void LogOutput::AppendDouble(double value)
+{
+    char temp[32];
+    std::to_chars_result result = std::to_chars(temp, temp + sizeof(temp), value);
+    Append(temp, result.ec == std::errc() ? static_cast<size_t>(result.ptr - temp) : 0);
+}
+
+void LogFormat::FormatArgs(LogOutput &out, const char *format, const ArgRef *args, size_t count)
+{
+    size_t next = 0;
+    const char *literal = format;
+    const char *pos = format;
+    while(*pos)
+    {
+        if((pos[0] == '{' || pos[0] == '}') && pos[1] == pos[0])
+        {
+            out.Append(literal, static_cast<size_t>(pos - literal) + 1);
+            pos += 2;
+            literal = pos;
+        }
+        else if(pos[0] == '{' && pos[1] == '}' && next < count)
+        {
+            out.Append(literal, static_cast<size_t>(pos - literal));
+            args[next].write(out, args[next].value);
+            ++next;
+            pos += 2;
+            literal = pos;
+        }
+        else
+        {
+            ++pos;
+        }
+    }
+
+    out.Append(literal, static_cast<size_t>(pos - literal));
+}
+
+const char *LogFormat::GetLevelTitle(int level, size_t *len)
+{
+    static const char *TITLES[] = {"[DEBUG]: ", "[INFO]: ", "[WARN]: ", "[ERROR]: "};
+    static const size_t TITLE_LENS[] = {9, 8, 8, 9};
+    level = level >= 0 && level <= 3 ? level : 1;
+    *len = TITLE_LENS[level];
+    return TITLES[level];
+}
@@ -0,0 +1,210 @@
+//
+// Created by ciaowhen on 2023/5/19.
+//
+
+#ifndef ADVANCECODE_LOGFORMAT_H
+#define ADVANCECODE_LOGFORMAT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+//有界输出位置, 写满后静默截断
+class LogOutput
+{
+public:
+    LogOutput(char *begin, size_t size):m_begin(begin), m_pos(begin), m_end(begin + size) {}
+
+    void Append(const char *data, size_t len)
+    {
+        len = std::min(len, static_cast<size_t>(m_end - m_pos));
+        memcpy(m_pos, data, len);
+        m_pos += len;
+    }
+
+    void Put(char c)
+    {
+        if(m_pos < m_end)
+        {
+            *m_pos++ = c;
+        }
+    }
+
+    void AppendSigned(int64_t value);
+    void AppendUnsigned(uint64_t value);
+    void AppendHex(uint64_t value);
+    void AppendDouble(double value);
+
+    size_t GetLength() const { return static_cast<size_t>(m_pos - m_begin); }
+
+private:
+    char *m_begin;
+    char *m_pos;
+    char *m_end;
+};
+
+//按类型格式化一个参数; 自定义类型特化LogArgFormatter<T>并提供static void Write(LogOutput&, const T&)即可
+template<class T, class Enable = void>
+struct LogArgFormatter
+{
+    static_assert(sizeof(T) == 0, "no LogArgFormatter specialization for this argument type");
+};
+
+template<>
+struct LogArgFormatter<bool>
+{
+    static void Write(LogOutput &out, bool value) { value ? out.Append("true", 4) : out.Append("false", 5); }
+};
+
+template<>
+struct LogArgFormatter<char>
+{
+    static void Write(LogOutput &out, char value) { out.Put(value); }
+};
+
+template<class T>
+struct LogArgFormatter<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value
+                                                  && !std::is_same<T, char>::value && !std::is_same<T, bool>::value>::type>
+{
+    static void Write(LogOutput &out, T value) { out.AppendSigned(value); }
+};
+
+template<class T>
+struct LogArgFormatter<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+                                                  && !std::is_same<T, char>::value && !std::is_same<T, bool>::value>::type>
+{
+    static void Write(LogOutput &out, T value) { out.AppendUnsigned(value); }
+};
+
+template<class T>
+struct LogArgFormatter<T, typename std::enable_if<std::is_enum<T>::value>::type>
+{
+    static void Write(LogOutput &out, T value)
+    {
+        LogArgFormatter<typename std::underlying_type<T>::type>::Write(out, static_cast<typename std::underlying_type<T>::type>(value));
+    }
+};
+
+template<class T>
+struct LogArgFormatter<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static void Write(LogOutput &out, T value) { out.AppendDouble(static_cast<double>(value)); }
+};
+
+template<>
+struct LogArgFormatter<const char *>
+{
+    static void Write(LogOutput &out, const char *value) { value ? out.Append(value, strlen(value)) : out.Append("(null)", 6); }
+};
+
+template<>
+struct LogArgFormatter<char *> : LogArgFormatter<const char *> {};
+
+template<size_t N>
+struct LogArgFormatter<char[N]>
+{
+    static void Write(LogOutput &out, const char (&value)[N]) { out.Append(value, strnlen(value, N)); }
+};
+
+template<>
+struct LogArgFormatter<std::string>
+{
+    static void Write(LogOutput &out, const std::string &value) { out.Append(value.data(), value.size()); }
+};
+
+template<>
+struct LogArgFormatter<std::string_view>
+{
+    static void Write(LogOutput &out, std::string_view value) { out.Append(value.data(), value.size()); }
+};
+
+template<class T>
+struct LogArgFormatter<T *, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+    static void Write(LogOutput &out, const T *value) { out.AppendHex(reinterpret_cast<uintptr_t>(value)); }
+};
+
+//"{}"为占位符, "{{"和"}}"输出花括号本身; 格式串必须是字面量, 由LOG_*宏在编译期检查占位符个数
+class LogFormat
+{
+public:
+    static const size_t BAD_FORMAT = static_cast<size_t>(-1);
+
+    //返回占位符个数, 花括号不配对时返回BAD_FORMAT
+    static constexpr size_t CountPlaceholders(const char *format)
+    {
+        size_t count = 0;
+        for(size_t i = 0; format[i] != '\0'; ++i)
+        {
+            if(format[i] == '{')
+            {
+                if(format[i + 1] == '{')
+                {
+                    ++i;
+                }
+                else if(format[i + 1] == '}')
+                {
+                    ++count;
+                    ++i;
+                }
+                else
+                {
+                    return BAD_FORMAT;
+                }
+            }
+            else if(format[i] == '}')
+            {
+                if(format[i + 1] != '}')
+                {
+                    return BAD_FORMAT;
+                }
+
+                ++i;
+            }
+        }
+
+        return count;
+    }
+
+    //只用于decltype, 在编译期取得参数个数
+    template<class... Args>
+    static std::integral_constant<size_t, sizeof...(Args)> CountArgs(const Args &...);
+
+    //参数的类型擦除引用, 格式化时按占位符顺序依次调用
+    struct ArgRef
+    {
+        template<class T>
+        ArgRef(const T &value):value(&value), write(&WriteArg<T>) {}
+
+        const void *value;
+        void (*write)(LogOutput &out, const void *value);
+    };
+
+    template<class... Args>
+    static size_t Format(char *dst, size_t size, const char *format, const Args &...args)
+    {
+        LogOutput out(dst, size);
+        const ArgRef refs[sizeof...(Args) + 1] = {ArgRef(args)..., ArgRef(format)};          //多一项避免空数组
+        FormatArgs(out, format, refs, sizeof...(Args));
+        return out.GetLength();
+    }
+
+    //多余的占位符原样输出, 多余的参数忽略
+    static void FormatArgs(LogOutput &out, const char *format, const ArgRef *args, size_t count);
+
+    //日志级别前缀"[INFO]: "等, 未知级别按INFO处理; 写日志和解码二进制日志共用
+    static const char *GetLevelTitle(int level, size_t *len);
+
+private:
+    template<class T>
+    static void WriteArg(LogOutput &out, const void *value)
+    {
+        LogArgFormatter<T>::Write(out, *static_cast<const T *>(value));
+    }
+};
+
+#endif //ADVANCECODE_LOGFORMAT_H
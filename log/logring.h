@@ -0,0 +1,173 @@
+//
+// Created by ciaowhen on 2023/5/17.
+//
+
+#ifndef ADVANCECODE_LOGRING_H
+#define ADVANCECODE_LOGRING_H
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+//多生产者单消费者的有界无锁环形队列, 槽位预先分配且大小固定
+//生产者抢到槽位后直接把日志格式化进槽位, 消费者(写线程)按批取出, 热路径上没有锁也没有堆分配
+class LogRing
+{
+public:
+    static const size_t RECORD_SIZE = 1024;             //每个槽位的字节数, 超长的日志行会被截断
+
+    struct alignas(64) Record
+    {
+        std::atomic<uint64_t> sequence;                 //等于槽位序号时可写, 等于序号+1时可读
+        uint32_t length;
+        char data[RECORD_SIZE - sizeof(std::atomic<uint64_t>) - sizeof(uint32_t)];
+    };
+
+    static const size_t DATA_SIZE = sizeof(Record::data);
+
+    explicit LogRing(size_t capacity = 1024):m_capacity(RoundUpPowerOfTwo(capacity)), m_mask(m_capacity - 1),
+                                            m_records(new Record[m_capacity]), m_head(0), m_tail(0), m_sleeping(false), m_close(false)
+    {
+        for(size_t i = 0; i < m_capacity; ++i)
+        {
+            m_records[i].sequence.store(i, std::memory_order_relaxed);
+            m_records[i].length = 0;
+        }
+    }
+
+    //取得一个可写槽位, 队列满时返回nullptr; 成功后必须调用Publish
+    char *TryClaim(uint64_t *ticket)
+    {
+        uint64_t pos = m_tail.load(std::memory_order_relaxed);
+        while(true)
+        {
+            Record &record = m_records[pos & m_mask];
+            int64_t diff = static_cast<int64_t>(record.sequence.load(std::memory_order_acquire) - pos);
+            if(diff == 0)
+            {
+                if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    *ticket = pos;
+                    return record.data;
+                }
+            }
+            else if(diff < 0)
+            {
+                return nullptr;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void Publish(uint64_t ticket, size_t length)
+    {
+        assert(length <= DATA_SIZE);
+        Record &record = m_records[ticket & m_mask];
+        record.length = static_cast<uint32_t>(length);
+        record.sequence.store(ticket + 1, std::memory_order_seq_cst);
+
+        //与Wait中先置睡眠标志再复查队列配对, 写线程不会错过唤醒; 写线程忙时不碰锁
+        if(m_sleeping.load(std::memory_order_seq_cst))
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_cond.notify_one();
+        }
+    }
+
+    //只能由写线程调用: 依次把已发布的记录交给func(data, length), 最多max_count条, 返回取出的条数
+    template<class F>
+    size_t Drain(F &&func, size_t max_count)
+    {
+        size_t count = 0;
+        while(count < max_count)
+        {
+            Record &record = m_records[m_head & m_mask];
+            if(record.sequence.load(std::memory_order_acquire) != m_head + 1)
+            {
+                break;
+            }
+
+            func(static_cast<const char *>(record.data), static_cast<size_t>(record.length));
+            record.sequence.store(m_head + m_capacity, std::memory_order_release);
+            ++m_head;
+            ++count;
+        }
+
+        return count;
+    }
+
+    bool IsEmpty() const
+    {
+        return m_records[m_head & m_mask].sequence.load(std::memory_order_acquire) != m_head + 1;
+    }
+
+    //写线程在队列为空时等待, 最多timeout_ms毫秒; 返回false表示队列已关闭
+    bool Wait(int timeout_ms)
+    {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        m_sleeping.store(true, std::memory_order_seq_cst);
+        //IsEmpty是acquire读, 不能与上面的store构成Dekker配对; 全屏障保证要么这里看到新记录, 要么Publish看到睡眠标志
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(IsEmpty() && !m_close.load())
+        {
+            m_cond.wait_for(locker, std::chrono::milliseconds(timeout_ms));
+        }
+
+        m_sleeping.store(false, std::memory_order_relaxed);
+        return !m_close.load();
+    }
+
+    void Notify()
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_cond.notify_one();
+    }
+
+    //关闭后生产者仍可写入, 由写线程在退出前把剩余记录取完
+    void Close()
+    {
+        m_close.store(true);
+        Notify();
+    }
+
+    bool IsClosed() const
+    {
+        return m_close.load();
+    }
+
+    size_t GetCapacity() const
+    {
+        return m_capacity;
+    }
+
+private:
+    static size_t RoundUpPowerOfTwo(size_t value)
+    {
+        size_t result = 1;
+        while(result < value)
+        {
+            result <<= 1;
+        }
+
+        return result;
+    }
+
+    const size_t m_capacity;
+    const size_t m_mask;
+    std::unique_ptr<Record[]> m_records;
+    alignas(64) uint64_t m_head;                        //只由写线程访问
+    alignas(64) std::atomic<uint64_t> m_tail;
+    alignas(64) std::atomic<bool> m_sleeping;
+    std::atomic<bool> m_close;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+#endif //ADVANCECODE_LOGRING_H
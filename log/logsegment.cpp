@@ -0,0 +1,292 @@
+//
+// Created by ciaowhen on 2023/5/21.
+//
+
+#include "logsegment.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+LogSegmentWriter::Segment::~Segment()
+{
+    if(data)
+    {
+        munmap(data, capacity);
+    }
+
+    if(fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+LogSegmentWriter::LogSegmentWriter(size_t segment_size, int sync_interval_ms):m_segment_size(segment_size > MIN_SEGMENT_SIZE ? segment_size : MIN_SEGMENT_SIZE),
+    m_sync_interval(sync_interval_ms), m_finishing(false), m_sync_request(false), m_stop(false)
+{
+    m_thread = std::thread(&LogSegmentWriter::Run, this);
+}
+
+LogSegmentWriter::~LogSegmentWriter()
+{
+    Close();
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_stop = true;
+        m_cond.notify_one();
+    }
+
+    m_thread.join();
+    if(m_ready)
+    {
+        Finish(*m_ready, true);
+    }
+}
+
+//目录不存在时先建目录, 与fopen写文本日志时的处理一致
+std::shared_ptr<LogSegmentWriter::Segment> LogSegmentWriter::CreateSegment(const std::string &path, bool populate)
+{
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        std::string dir = path.substr(0, path.find_last_of('/'));
+        mkdir(dir.c_str(), 0777);
+        fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if(fd < 0)
+        {
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+    segment->path = path;
+    segment->fd = fd;
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        return nullptr;
+    }
+
+    segment->base = static_cast<size_t>(st.st_size);
+    segment->used.store(segment->base, std::memory_order_relaxed);
+    segment->synced = segment->base;
+    segment->capacity = segment->base + m_segment_size;
+
+    //预先分配磁盘块, 写入时不会因为分配空间或文件变长而阻塞; 文件系统不支持时退回ftruncate
+    if(fallocate(fd, 0, 0, static_cast<off_t>(segment->capacity)) != 0 && ftruncate(fd, static_cast<off_t>(segment->capacity)) != 0)
+    {
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, segment->capacity, PROT_READ | PROT_WRITE, MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+    if(data == MAP_FAILED)
+    {
+        ftruncate(fd, static_cast<off_t>(segment->base));
+        return nullptr;
+    }
+
+    segment->data = static_cast<char *>(data);
+    return segment;
+}
+
+bool LogSegmentWriter::Open(const std::string &path)
+{
+    std::shared_ptr<Segment> next;
+    {
+        std::unique_lock<std::mutex> locker(m_mutex);
+        m_ready_cond.wait(locker, [&]{ return m_preparing_path != path; });
+        if(m_ready && m_ready->path == path)
+        {
+            next = std::move(m_ready);
+        }
+    }
+
+    if(!next)
+    {
+        next = CreateSegment(path, false);
+        if(!next)
+        {
+            return false;
+        }
+    }
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    if(m_current)
+    {
+        m_retired.push_back(std::move(m_current));
+    }
+
+    m_current = std::move(next);
+    m_cond.notify_one();
+    return true;
+}
+
+void LogSegmentWriter::Prepare(const std::string &path)
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_prepare_path = path;
+    m_cond.notify_one();
+}
+
+void LogSegmentWriter::Close()
+{
+    std::unique_lock<std::mutex> locker(m_mutex);
+    if(m_current)
+    {
+        m_retired.push_back(std::move(m_current));
+        m_cond.notify_one();
+    }
+
+    m_ready_cond.wait(locker, [this]{ return m_retired.empty() && !m_finishing; });
+}
+
+size_t LogSegmentWriter::GetRoom() const
+{
+    return m_current ? m_current->capacity - m_current->used.load(std::memory_order_relaxed) : 0;
+}
+
+void LogSegmentWriter::Append(const char *data, size_t len)
+{
+    if(!m_current)
+    {
+        return;
+    }
+
+    size_t used = m_current->used.load(std::memory_order_relaxed);
+    len = std::min(len, m_current->capacity - used);
+    memcpy(m_current->data + used, data, len);
+    m_current->used.store(used + len, std::memory_order_release);
+}
+
+void LogSegmentWriter::Flush()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    m_sync_request = true;
+    m_cond.notify_one();
+}
+
+void LogSegmentWriter::SyncSegment(Segment &segment)
+{
+    size_t used = segment.used.load(std::memory_order_acquire);
+    if(used <= segment.synced)
+    {
+        return;
+    }
+
+    //msync要求起始地址按页对齐
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = segment.synced / page * page;
+    msync(segment.data + begin, used - begin, MS_SYNC);
+    segment.synced = used;
+}
+
+//换下的文件截断到实际写入的长度, 预建后没用上的空文件直接删除
+void LogSegmentWriter::Finish(Segment &segment, bool discard)
+{
+    size_t used = segment.used.load(std::memory_order_acquire);
+    if(m_sync_interval.count() > 0)
+    {
+        SyncSegment(segment);
+    }
+
+    munmap(segment.data, segment.capacity);
+    segment.data = nullptr;
+    ftruncate(segment.fd, static_cast<off_t>(used));
+    if(discard && used == 0)
+    {
+        unlink(segment.path.c_str());
+    }
+}
+
+void LogSegmentWriter::Run()
+{
+    auto next_sync = std::chrono::steady_clock::now() + m_sync_interval;
+    std::unique_lock<std::mutex> locker(m_mutex);
+    while(true)
+    {
+        if(m_prepare_path.empty() && m_retired.empty() && !m_sync_request && !m_stop)
+        {
+            if(m_sync_interval.count() > 0)
+            {
+                m_cond.wait_until(locker, next_sync);
+            }
+            else
+            {
+                m_cond.wait(locker);
+            }
+        }
+
+        std::vector<std::shared_ptr<Segment>> retired;
+        retired.swap(m_retired);
+        m_finishing = !retired.empty();
+        std::shared_ptr<Segment> discard;
+        std::string path;
+        path.swap(m_prepare_path);
+        if(!path.empty() && m_ready && m_ready->path != path)
+        {
+            discard = std::move(m_ready);
+        }
+
+        if(!path.empty() && !m_ready)
+        {
+            m_preparing_path = path;
+        }
+        else
+        {
+            path.clear();
+        }
+
+        bool sync = m_sync_request || (m_sync_interval.count() > 0 && std::chrono::steady_clock::now() >= next_sync);
+        m_sync_request = false;
+        std::shared_ptr<Segment> current = sync ? m_current : nullptr;
+        bool stop = m_stop;
+        locker.unlock();
+
+        for(auto &segment : retired)
+        {
+            Finish(*segment, false);
+        }
+
+        if(discard)
+        {
+            Finish(*discard, true);
+        }
+
+        if(!retired.empty())
+        {
+            retired.clear();
+            locker.lock();
+            m_finishing = false;
+            m_ready_cond.notify_all();
+            locker.unlock();
+        }
+
+        if(!path.empty())
+        {
+            std::shared_ptr<Segment> segment = CreateSegment(path, true);
+            locker.lock();
+            m_ready = std::move(segment);
+            m_preparing_path.clear();
+            m_ready_cond.notify_all();
+            locker.unlock();
+        }
+
+        if(current)
+        {
+            SyncSegment(*current);
+        }
+
+        if(sync)
+        {
+            next_sync = std::chrono::steady_clock::now() + m_sync_interval;
+        }
+
+        locker.lock();
+        if(stop && m_retired.empty())
+        {
+            break;
+        }
+    }
+}
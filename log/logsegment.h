@@ -0,0 +1,79 @@
+//
+// Created by ciaowhen on 2023/5/21.
+//
+
+#ifndef ADVANCECODE_LOGSEGMENT_H
+#define ADVANCECODE_LOGSEGMENT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//mmap写日志文件: 每个文件按固定大小fallocate后整段映射, 写入只是memcpy
+//后台线程预先建好下一个文件, 切换时只交换指针; 换下的文件由后台线程按实际长度截断并关闭, 按设定周期msync
+class LogSegmentWriter
+{
+public:
+    static const size_t MIN_SEGMENT_SIZE = 1024 * 1024;
+
+    //sync_interval_ms为0时不主动刷盘, 交给内核回写
+    LogSegmentWriter(size_t segment_size, int sync_interval_ms);
+    ~LogSegmentWriter();
+
+    //切换到path, 已预建好的直接换上, 否则当场创建; 已存在的文件从末尾续写
+    bool Open(const std::string &path);
+    //让后台线程预建下一个文件
+    void Prepare(const std::string &path);
+    //关闭当前文件并等后台线程截断完成, 之后可以重新打开同一个文件
+    void Close();
+
+    //当前文件的剩余空间, 调用方放不下时应先切换文件
+    size_t GetRoom() const;
+    //超出剩余空间的部分被丢弃
+    void Append(const char *data, size_t len);
+    //请后台线程立即刷盘, 不等待完成
+    void Flush();
+
+private:
+    struct Segment
+    {
+        ~Segment();
+
+        std::string path;
+        int fd = -1;
+        char *data = nullptr;
+        size_t capacity = 0;
+        size_t base = 0;                                //打开时文件已有的长度
+        std::atomic<size_t> used{0};
+        size_t synced = 0;                              //只由后台线程访问
+    };
+
+    std::shared_ptr<Segment> CreateSegment(const std::string &path, bool populate);
+    void Finish(Segment &segment, bool discard);
+    void SyncSegment(Segment &segment);
+    void Run();
+
+private:
+    size_t m_segment_size;
+    std::chrono::milliseconds m_sync_interval;
+    std::shared_ptr<Segment> m_current;                 //只由写日志的一方换上和写入, 后台线程持有副本做msync
+
+    std::mutex m_mutex;                                 //保护下面的成员与m_current的指针本身
+    std::condition_variable m_cond;
+    std::condition_variable m_ready_cond;               //预建完成或换下的文件收尾完成
+    std::string m_prepare_path;                         //待预建的文件
+    std::string m_preparing_path;                       //正在预建的文件
+    std::shared_ptr<Segment> m_ready;
+    std::vector<std::shared_ptr<Segment>> m_retired;
+    bool m_finishing;                                   //后台线程正在收尾换下的文件
+    bool m_sync_request;
+    bool m_stop;
+    std::thread m_thread;
+};
+
+#endif //ADVANCECODE_LOGSEGMENT_H
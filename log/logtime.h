@@ -0,0 +1,69 @@
+//
+// Created by ciaowhen on 2023/5/18.
+//
+
+#ifndef ADVANCECODE_LOGTIME_H
+#define ADVANCECODE_LOGTIME_H
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+//日志时间前缀缓存: 每个线程一份, 秒数变化时才调用localtime_r重新格式化, 同一秒内只拷贝缓存并追加微秒
+class LogTimestamp
+{
+public:
+    static const size_t SECOND_LEN = 19;                //"YYYY-MM-DD HH:MM:SS"
+    static const size_t MAX_LEN = SECOND_LEN + 7;       //带".uuuuuu"
+
+    //dst至少MAX_LEN字节, 返回写入的长度, 不写结尾的'\0'
+    static size_t Format(char *dst, bool microseconds)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        return Format(dst, now.tv_sec, static_cast<long>(now.tv_nsec / 1000), microseconds);
+    }
+
+    static size_t Format(char *dst, time_t second, long microsecond, bool microseconds)
+    {
+        Cache &cache = GetCache();
+        if(second != cache.second)
+        {
+            struct tm sys_time;
+            localtime_r(&second, &sys_time);
+            snprintf(cache.text, sizeof(cache.text), "%04d-%02d-%02d %02d:%02d:%02d", sys_time.tm_year + 1900, sys_time.tm_mon + 1,
+                     sys_time.tm_mday, sys_time.tm_hour, sys_time.tm_min, sys_time.tm_sec);
+            cache.second = second;
+        }
+
+        memcpy(dst, cache.text, SECOND_LEN);
+        if(!microseconds)
+        {
+            return SECOND_LEN;
+        }
+
+        dst[SECOND_LEN] = '.';
+        for(int i = 6; i > 0; --i)
+        {
+            dst[SECOND_LEN + i] = static_cast<char>('0' + microsecond % 10);
+            microsecond /= 10;
+        }
+
+        return MAX_LEN;
+    }
+
+private:
+    struct Cache
+    {
+        time_t second = -1;
+        char text[64];                                  //留足余量, 年份超过4位时snprintf也不会截断
+    };
+
+    static Cache &GetCache()
+    {
+        static thread_local Cache cache;
+        return cache;
+    }
+};
+
+#endif //ADVANCECODE_LOGTIME_H
@@ -0,0 +1,450 @@
+//
+// Created by ciaowhen on 2023/5/23.
+//
+
+#ifndef ADVANCECODE_MPMCQUEUE_H
+#define ADVANCECODE_MPMCQUEUE_H
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <new>
+#include <thread>
+#include <utility>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//多生产者多消费者的有界无锁队列, 接口与BlockDeque一致, 可以作为模板参数互换
+//每个槽位带序号: 等于位置时可写, 等于位置+1时可读, 出队后加上容量留给下一轮; 槽位和头尾指针各占一个缓存行
+//等待时先自旋, 再让出CPU, 最后用futex睡眠; 只有存在睡眠者时入队/出队一方才发起唤醒
+//不支持PushFront/GetFront/GetBack, 容量向上取整为2的幂
+//Flush与BlockDeque一样只唤醒消费者, 队列仍为空且未关闭时消费者继续等待
+template<class T>
+class MpmcQueue
+{
+public:
+    explicit MpmcQueue(size_t max_capacity = 1000);
+    ~MpmcQueue();
+    void Clear();
+    void Close();
+    bool IsClosed();
+    bool IsEmpty();
+    bool IsFull();
+    size_t GetQueueSize();
+    size_t GetCapacity();
+    void PushBack(const T &item);
+    void PushBack(T &&item);
+    template<class... Args>
+    void Emplace(Args&&... args);
+    bool TryPushBack(const T &item);                    //满了或已关闭时返回false, 不等待
+    bool TryPushBack(T &&item);                         //失败时item保持原样
+    bool PopFront(T &item);
+    bool TryPopFront(T &item);
+    bool PopFront(T &item, int timeout);                //timeout单位为秒
+    bool PopFront(T &item, std::chrono::milliseconds timeout);
+    bool PopAll(std::deque<T> &items);
+    template<class Container>
+    size_t DrainTo(Container &out, size_t max, std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+    void Flush();
+
+private:
+    static const int SPIN_COUNT = 64;
+    static const int YIELD_COUNT = 16;
+
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T *Get() { return reinterpret_cast<T *>(storage); }
+    };
+
+    //睡眠者登记后读epoch, 对方改完队列后发现有睡眠者就推进epoch并唤醒, futex比较epoch防止漏掉唤醒
+    struct alignas(64) Waiters
+    {
+        std::atomic<uint32_t> epoch{0};
+        std::atomic<uint32_t> count{0};
+    };
+
+    template<class... Args>
+    bool TryPush(Args&&... args);
+    bool TryPop(T &item);
+    template<class Sink>
+    bool TryPopTo(Sink &&sink);
+    template<class Try>
+    bool Wait(Waiters &waiters, Try &&attempt, std::chrono::milliseconds timeout);
+    static void Wake(Waiters &waiters, int count);
+    static void Pause();
+
+private:
+    size_t m_capacity;
+    uint64_t m_mask;
+    std::unique_ptr<Slot[]> m_slots;
+    alignas(64) std::atomic<uint64_t> m_tail;           //下一个入队位置
+    alignas(64) std::atomic<uint64_t> m_head;           //下一个出队位置
+    alignas(64) std::atomic<bool> m_close;
+    Waiters m_consumer;                                 //等待非空
+    Waiters m_producer;                                 //等待非满
+};
+
+template<class T>
+MpmcQueue<T>::MpmcQueue(size_t max_capacity):m_tail(0), m_head(0), m_close(false)
+{
+    assert(max_capacity > 0);
+    //容量为1时可写与可读的序号会重合
+    m_capacity = 2;
+    while(m_capacity < max_capacity)
+    {
+        m_capacity <<= 1;
+    }
+
+    m_mask = m_capacity - 1;
+    m_slots.reset(new Slot[m_capacity]);
+    for(size_t i = 0; i < m_capacity; ++i)
+    {
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+template<class T>
+MpmcQueue<T>::~MpmcQueue()
+{
+    Close();
+}
+
+template<class T>
+void MpmcQueue<T>::Close()
+{
+    m_close.store(true, std::memory_order_seq_cst);
+    Clear();
+    Wake(m_producer, INT_MAX);
+    Wake(m_consumer, INT_MAX);
+}
+
+template<class T>
+void MpmcQueue<T>::Clear()
+{
+    while(TryPopTo([](T &&){}))
+    {
+    }
+
+    Wake(m_producer, INT_MAX);
+}
+
+template<class T>
+bool MpmcQueue<T>::IsClosed()
+{
+    return m_close.load(std::memory_order_acquire);
+}
+
+template<class T>
+bool MpmcQueue<T>::IsEmpty()
+{
+    return GetQueueSize() == 0;
+}
+
+template<class T>
+bool MpmcQueue<T>::IsFull()
+{
+    return GetQueueSize() >= m_capacity;
+}
+
+//并发修改时只是近似值, 包含已抢到位置但还没写完的元素
+template<class T>
+size_t MpmcQueue<T>::GetQueueSize()
+{
+    uint64_t head = m_head.load(std::memory_order_acquire);
+    uint64_t tail = m_tail.load(std::memory_order_acquire);
+    return tail > head ? static_cast<size_t>(tail - head) : 0;
+}
+
+template<class T>
+size_t MpmcQueue<T>::GetCapacity()
+{
+    return m_capacity;
+}
+
+template<class T>
+template<class... Args>
+bool MpmcQueue<T>::TryPush(Args&&... args)
+{
+    if(m_close.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+
+    uint64_t pos = m_tail.load(std::memory_order_relaxed);
+    while(true)
+    {
+        Slot &slot = m_slots[pos & m_mask];
+        int64_t diff = static_cast<int64_t>(slot.sequence.load(std::memory_order_acquire) - pos);
+        if(diff == 0)
+        {
+            if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                new(slot.storage) T(std::forward<Args>(args)...);
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                Wake(m_consumer, 1);
+                return true;
+            }
+        }
+        else if(diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template<class T>
+bool MpmcQueue<T>::TryPop(T &item)
+{
+    return TryPopTo([&item](T &&value){ item = std::move(value); });
+}
+
+//只出队不唤醒生产者, 由调用方在一次或一批出队之后唤醒; 元素直接移交给sink, 不要求T可以默认构造
+template<class T>
+template<class Sink>
+bool MpmcQueue<T>::TryPopTo(Sink &&sink)
+{
+    //sink抛异常时槽位也要析构并交还, 否则队列卡在这个位置
+    struct Release
+    {
+        Slot &slot;
+        uint64_t sequence;
+        ~Release()
+        {
+            slot.Get()->~T();
+            slot.sequence.store(sequence, std::memory_order_release);
+        }
+    };
+
+    uint64_t pos = m_head.load(std::memory_order_relaxed);
+    while(true)
+    {
+        Slot &slot = m_slots[pos & m_mask];
+        int64_t diff = static_cast<int64_t>(slot.sequence.load(std::memory_order_acquire) - (pos + 1));
+        if(diff == 0)
+        {
+            if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                Release release{slot, pos + m_capacity};
+                sink(std::move(*slot.Get()));
+                return true;
+            }
+        }
+        else if(diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+template<class T>
+void MpmcQueue<T>::PushBack(const T &item)
+{
+    Wait(m_producer, [&]{ return TryPush(item); }, std::chrono::milliseconds(-1));
+}
+
+template<class T>
+void MpmcQueue<T>::PushBack(T &&item)
+{
+    Wait(m_producer, [&]{ return TryPush(std::move(item)); }, std::chrono::milliseconds(-1));
+}
+
+//参数只在抢到槽位后使用一次, 重试时不会被提前移走
+template<class T>
+template<class... Args>
+void MpmcQueue<T>::Emplace(Args&&... args)
+{
+    Wait(m_producer, [&]{ return TryPush(std::forward<Args>(args)...); }, std::chrono::milliseconds(-1));
+}
+
+template<class T>
+bool MpmcQueue<T>::TryPushBack(const T &item)
+{
+    return TryPush(item);
+}
+
+template<class T>
+bool MpmcQueue<T>::TryPushBack(T &&item)
+{
+    return TryPush(std::move(item));
+}
+
+template<class T>
+bool MpmcQueue<T>::PopFront(T &item)
+{
+    return PopFront(item, std::chrono::milliseconds(-1));
+}
+
+template<class T>
+bool MpmcQueue<T>::TryPopFront(T &item)
+{
+    if(!TryPop(item))
+    {
+        return false;
+    }
+
+    Wake(m_producer, 1);
+    return true;
+}
+
+template<class T>
+bool MpmcQueue<T>::PopFront(T &item, int timeout)
+{
+    return PopFront(item, std::chrono::seconds(timeout));
+}
+
+template<class T>
+bool MpmcQueue<T>::PopFront(T &item, std::chrono::milliseconds timeout)
+{
+    if(!Wait(m_consumer, [&]{ return TryPop(item); }, timeout))
+    {
+        return false;
+    }
+
+    Wake(m_producer, 1);
+    return true;
+}
+
+template<class T>
+bool MpmcQueue<T>::PopAll(std::deque<T> &items)
+{
+    items.clear();
+    return DrainTo(items, m_capacity) > 0;
+}
+
+template<class T>
+template<class Container>
+size_t MpmcQueue<T>::DrainTo(Container &out, size_t max, std::chrono::milliseconds timeout)
+{
+    auto sink = [&out](T &&value){ out.push_back(std::move(value)); };
+    if(max == 0 || !Wait(m_consumer, [&]{ return TryPopTo(sink); }, timeout))
+    {
+        return 0;
+    }
+
+    size_t count = 1;
+    while(count < max && TryPopTo(sink))
+    {
+        ++count;
+    }
+
+    Wake(m_producer, INT_MAX);
+    return count;
+}
+
+template<class T>
+void MpmcQueue<T>::Flush()
+{
+    Wake(m_consumer, 1);
+}
+
+//attempt成功返回true; 关闭或超时返回false, timeout小于0时一直等
+template<class T>
+template<class Try>
+bool MpmcQueue<T>::Wait(Waiters &waiters, Try &&attempt, std::chrono::milliseconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    for(int i = 0; i < SPIN_COUNT + YIELD_COUNT; ++i)
+    {
+        if(attempt())
+        {
+            return true;
+        }
+
+        if(m_close.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+
+        if(i < SPIN_COUNT)
+        {
+            Pause();
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    while(true)
+    {
+        waiters.count.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint32_t epoch = waiters.epoch.load(std::memory_order_acquire);
+        bool done = attempt();
+        bool released = m_close.load(std::memory_order_seq_cst);
+        struct timespec remain;
+        struct timespec *wait_time = nullptr;
+        if(!done && !released && timeout.count() >= 0)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if(left <= 0)
+            {
+                waiters.count.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            remain.tv_sec = static_cast<time_t>(left / 1000000000);
+            remain.tv_nsec = static_cast<long>(left % 1000000000);
+            wait_time = &remain;
+        }
+
+        if(!done && !released)
+        {
+            syscall(SYS_futex, &waiters.epoch, FUTEX_WAIT_PRIVATE, epoch, wait_time, nullptr, 0);
+        }
+
+        waiters.count.fetch_sub(1, std::memory_order_relaxed);
+        if(done)
+        {
+            return true;
+        }
+
+        if(released)
+        {
+            return false;
+        }
+    }
+}
+
+//修改队列与检查睡眠者之间的全屏障, 与Wait中登记睡眠者与检查队列之间的全屏障配对
+template<class T>
+void MpmcQueue<T>::Wake(Waiters &waiters, int count)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(waiters.count.load(std::memory_order_relaxed) == 0)
+    {
+        return;
+    }
+
+    waiters.epoch.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &waiters.epoch, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+template<class T>
+void MpmcQueue<T>::Pause()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+#endif //ADVANCECODE_MPMCQUEUE_H
@@ -0,0 +1,161 @@
+//
+// Created by ciaowhen on 2023/5/25.
+//
+
+#include "../log/log.h"
+#include <cstdio>
+#include <cstdlib>
+#include <dirent.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+//二进制模式下写超过单行上限的printf风格日志, 检查记录能完整解出且正文被截断在上限以内
+namespace
+{
+    int failures = 0;
+
+    void Check(bool ok, const char *what)
+    {
+        if(!ok)
+        {
+            fprintf(stderr, "FAILED: %s\n", what);
+            failures++;
+        }
+    }
+
+    //读出目录下唯一的日志文件后把它和目录一起删掉
+    bool ReadLogFile(const char *dir, std::vector<char> &data)
+    {
+        DIR *handle = opendir(dir);
+        if(!handle)
+        {
+            return false;
+        }
+
+        std::string path;
+        while(struct dirent *entry = readdir(handle))
+        {
+            if(entry->d_name[0] != '.')
+            {
+                path = std::string(dir) + "/" + entry->d_name;
+            }
+        }
+
+        closedir(handle);
+        FILE *file = path.empty() ? nullptr : fopen(path.c_str(), "rb");
+        if(!file)
+        {
+            return false;
+        }
+
+        char block[4096];
+        size_t n = 0;
+        while((n = fread(block, 1, sizeof(block), file)) > 0)
+        {
+            data.insert(data.end(), block, block + n);
+        }
+
+        fclose(file);
+        unlink(path.c_str());
+        rmdir(dir);
+        return true;
+    }
+}
+
+//超过单行上限的格式串, 写不进字典
+#define TEN_CHARS "0123456789"
+#define HUNDRED_CHARS TEN_CHARS TEN_CHARS TEN_CHARS TEN_CHARS TEN_CHARS TEN_CHARS TEN_CHARS TEN_CHARS TEN_CHARS TEN_CHARS
+#define LONG_FORMAT HUNDRED_CHARS HUNDRED_CHARS HUNDRED_CHARS HUNDRED_CHARS HUNDRED_CHARS HUNDRED_CHARS \
+    HUNDRED_CHARS HUNDRED_CHARS HUNDRED_CHARS HUNDRED_CHARS HUNDRED_CHARS HUNDRED_CHARS " {}"
+
+namespace
+{
+    //一个参数放不下后, 后面的参数不能再写进记录, 否则解码时与占位符错位
+    void CheckEventTruncation()
+    {
+        char dst[64];
+        LogBinary::Record record;
+        size_t len = LogBinary::EncodeEvent(dst, 20, 1, 1, 2.5, 3);
+        const char *pos = dst;
+        Check(len > 0 && LogBinary::Decode(pos, dst + len, record), "decode event with dropped argument");
+        Check(record.args.size() == 1 && record.args[0].i == 1, "arguments after a dropped one are not encoded");
+
+        len = LogBinary::EncodeEvent(dst, sizeof(dst), 1, 1, std::string(100, 'x'), 7);
+        pos = dst;
+        Check(len == sizeof(dst) && LogBinary::Decode(pos, dst + len, record), "decode event with clipped string");
+        Check(record.args.size() == 2 && record.args[1].s.size() > 3 && record.args[1].s.compare(record.args[1].s.size() - 3, 3, "...") == 0,
+              "string argument clipped to the remaining space");
+    }
+}
+
+int main()
+{
+    char dir[] = "/tmp/log_binary_test_XXXXXX";
+    if(!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    CheckEventTruncation();
+
+    const size_t max_line_len = LogRing::DATA_SIZE;
+    std::string exact(max_line_len, 'a');
+    std::string longer(max_line_len * 3, 'b');
+
+    Log *log = Log::Instance();
+    log->Init(Log::LL_DEBUG, dir, ".log", 0, Log::AM_BLOCK_DEQUE, true);
+    log->Write(Log::LL_INFO, "%s", exact.c_str());
+    log->Write(Log::LL_INFO, "%s", longer.c_str());
+    LOG_INFO("{} {}", longer, 42);
+    LOG_INFO(LONG_FORMAT, 42);
+    log->Flush();
+
+    std::vector<char> data;
+    Check(ReadLogFile(dir, data), "read log file");
+
+    std::vector<std::string> texts;
+    int events = 0;
+    LogBinary::Record record;
+    const char *pos = data.data();
+    const char *end = pos + data.size();
+    while(pos < end)
+    {
+        if(!LogBinary::Decode(pos, end, record))
+        {
+            Check(false, "decode record");
+            break;
+        }
+
+        if(record.type == LogBinary::RT_TEXT)
+        {
+            Check(!record.format.empty() && record.format.size() < max_line_len, "text body truncated below line limit");
+            texts.push_back(record.format);
+        }
+        else if(record.type == LogBinary::RT_EVENT)
+        {
+            //超长字符串截到记录剩余空间, 后面的参数不再写入
+            Check(record.args.size() == 1 && record.args[0].s.find_first_not_of('b') == record.args[0].s.size() - 3, "oversized event argument clipped");
+            events++;
+        }
+    }
+
+    //两条printf风格的正文, 超长格式串的报错, 以及该调用点改写的文本记录
+    Check(texts.size() == 4, "four text records");
+    if(texts.size() == 4)
+    {
+        Check(texts[0].find_first_not_of('a') == std::string::npos, "first text body content");
+        Check(texts[1].find_first_not_of('b') == std::string::npos, "second text body content");
+        Check(texts[2].find("too long") != std::string::npos, "long format reported");
+        Check(texts[3].compare(0, 10, "0123456789") == 0, "long format written as text");
+    }
+
+    Check(events == 1, "one event record");
+    if(failures == 0)
+    {
+        printf("log_binary_test passed\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+//
+// Created by ciaowhen on 2023/5/26.
+//
+
+#include "../threadpool/sqlconnpool.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+//用Connector钩子换上本地的假后端, 不需要MySQL服务端就能检查连接池的建立, 增长, 收缩, 等待超时与断线重连
+namespace
+{
+    int failures = 0;
+
+    void Check(bool ok, const char *what)
+    {
+        if(!ok)
+        {
+            fprintf(stderr, "FAILED: %s\n", what);
+            failures++;
+        }
+    }
+
+    //假连接只是一块MYSQL大小的内存, 连接池不会把它交给客户端库
+    struct FakeBackend
+    {
+        std::mutex mtx;
+        std::set<MYSQL *> open;
+        std::set<MYSQL *> dead;                         //ping失败的连接
+        int connects = 0;
+        int closes = 0;
+        int fail_connects = 0;                          //接下来失败的连接次数
+        int connect_delay_ms = 0;
+        std::atomic<int> connecting{0};
+        std::atomic<int> max_connecting{0};
+
+        SqlConnPool::Connector MakeConnector()
+        {
+            SqlConnPool::Connector connector;
+            connector.connect = [this]{ return Connect(); };
+            connector.close = [this](MYSQL *sql){ Close(sql); };
+            connector.ping = [this](MYSQL *sql){ return Ping(sql); };
+            return connector;
+        }
+
+        MYSQL *Connect()
+        {
+            int now = connecting.fetch_add(1) + 1;
+            int max = max_connecting.load();
+            while(now > max && !max_connecting.compare_exchange_weak(max, now))
+            {
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(connect_delay_ms));
+            connecting.fetch_sub(1);
+            std::lock_guard<std::mutex> locker(mtx);
+            connects++;
+            if(fail_connects > 0)
+            {
+                fail_connects--;
+                return nullptr;
+            }
+
+            MYSQL *sql = new MYSQL();
+            open.insert(sql);
+            return sql;
+        }
+
+        void Close(MYSQL *sql)
+        {
+            std::lock_guard<std::mutex> locker(mtx);
+            closes++;
+            open.erase(sql);
+            delete sql;
+        }
+
+        bool Ping(MYSQL *sql)
+        {
+            std::lock_guard<std::mutex> locker(mtx);
+            return dead.count(sql) == 0;
+        }
+
+        int GetCloseCount()
+        {
+            std::lock_guard<std::mutex> locker(mtx);
+            return closes;
+        }
+
+        int GetOpenCount()
+        {
+            std::lock_guard<std::mutex> locker(mtx);
+            return static_cast<int>(open.size());
+        }
+    };
+
+    SqlConnPool::Config MakeConfig(FakeBackend &backend, int min_conn_num, int max_conn_num)
+    {
+        SqlConnPool::Config config;
+        config.min_conn_num = min_conn_num;
+        config.max_conn_num = max_conn_num;
+        config.stmt_cache_size = 0;
+        config.connector = backend.MakeConnector();
+        return config;
+    }
+
+    //Init时多个线程并行建立连接, 总耗时接近单个连接而不是逐个相加
+    void CheckParallelWarmup()
+    {
+        FakeBackend backend;
+        backend.connect_delay_ms = 50;
+        SqlConnPool::Config config = MakeConfig(backend, 8, 8);
+        config.warmup_threads = 4;
+
+        SqlConnPool *pool = SqlConnPool::Instance();
+        auto begin = std::chrono::steady_clock::now();
+        Check(pool->Init(config), "warmup opens every connection");
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        Check(pool->GetConnCount() == 8 && pool->GetFreeConnCount() == 8, "warmup connection count");
+        Check(backend.max_connecting.load() > 1, "warmup connects in parallel");
+        Check(elapsed < std::chrono::milliseconds(8 * 50), "warmup faster than serial connects");
+        pool->Close();
+        Check(backend.GetOpenCount() == 0, "close releases warmed up connections");
+    }
+
+    //Init时有连接建立失败, Init返回false但连接池可用, 缺少的连接在取用时补建
+    void CheckWarmupFailure()
+    {
+        FakeBackend backend;
+        backend.fail_connects = 2;
+        SqlConnPool::Config config = MakeConfig(backend, 4, 4);
+        config.warmup_threads = 1;
+
+        SqlConnPool *pool = SqlConnPool::Instance();
+        Check(!pool->Init(config), "init reports missing connections");
+        Check(pool->GetConnCount() == 2, "failed connects are not counted");
+        Check(pool->GetStats().connect_failures == 2, "connect failures counted");
+
+        std::vector<MYSQL *> conns;
+        for(int i = 0; i < 4; ++i)
+        {
+            conns.push_back(pool->GetSqlConn(0));
+            Check(conns.back() != nullptr, "missing connections opened on demand");
+        }
+
+        Check(pool->GetConnCount() == 4, "pool refilled to max after failed warmup");
+        for(MYSQL *sql : conns)
+        {
+            pool->FreeConn(sql);
+        }
+
+        pool->Close();
+        Check(backend.GetOpenCount() == 0, "close releases refilled connections");
+    }
+
+    //从min_conn_num按需增长到max_conn_num, 到上限后不再新建
+    void CheckGrowth()
+    {
+        FakeBackend backend;
+        SqlConnPool *pool = SqlConnPool::Instance();
+        Check(pool->Init(MakeConfig(backend, 1, 4)), "init with one connection");
+        Check(pool->GetConnCount() == 1, "starts at min_conn_num");
+
+        std::vector<MYSQL *> conns;
+        for(int i = 0; i < 4; ++i)
+        {
+            conns.push_back(pool->GetSqlConn(0));
+            Check(conns.back() != nullptr, "grows on demand");
+        }
+
+        Check(pool->GetConnCount() == 4 && backend.connects == 4, "grows up to max_conn_num");
+        Check(pool->GetSqlConn(0) == nullptr, "no connection beyond max_conn_num");
+        Check(backend.connects == 4, "no connect attempted at max_conn_num");
+        for(MYSQL *sql : conns)
+        {
+            pool->FreeConn(sql);
+        }
+
+        Check(pool->GetFreeConnCount() == 4, "returned connections become idle");
+        pool->Close();
+    }
+
+    //空闲超时后关闭多出的连接, 收缩到min_conn_num为止
+    void CheckIdleShrink()
+    {
+        FakeBackend backend;
+        SqlConnPool::Config config = MakeConfig(backend, 2, 6);
+        config.idle_timeout_ms = 40;
+
+        SqlConnPool *pool = SqlConnPool::Instance();
+        Check(pool->Init(config), "init with idle timeout");
+        std::vector<MYSQL *> conns;
+        for(int i = 0; i < 6; ++i)
+        {
+            conns.push_back(pool->GetSqlConn(0));
+        }
+
+        Check(pool->GetConnCount() == 6, "grown before shrinking");
+        for(MYSQL *sql : conns)
+        {
+            pool->FreeConn(sql);
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while((pool->GetConnCount() > 2 || backend.GetOpenCount() > 2) && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        Check(pool->GetConnCount() == 2 && pool->GetFreeConnCount() == 2, "idle connections shrink to min_conn_num");
+        Check(backend.GetOpenCount() == 2, "shrunk connections are closed");
+        pool->Close();
+    }
+
+    //连接全部借出时等到acquire_timeout_ms后返回nullptr并计入超时
+    void CheckAcquireTimeout()
+    {
+        FakeBackend backend;
+        SqlConnPool::Config config = MakeConfig(backend, 2, 2);
+        config.acquire_timeout_ms = 150;
+
+        SqlConnPool *pool = SqlConnPool::Instance();
+        Check(pool->Init(config), "init for acquire timeout");
+        MYSQL *first = pool->GetSqlConn();
+        MYSQL *second = pool->GetSqlConn();
+        Check(first && second, "borrow every connection");
+
+        auto begin = std::chrono::steady_clock::now();
+        Check(pool->GetSqlConn() == nullptr, "exhausted pool returns nullptr");
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        Check(elapsed >= std::chrono::milliseconds(140) && elapsed < std::chrono::seconds(1), "waits about acquire_timeout_ms");
+        Check(pool->GetStats().timeouts == 1, "timeout counted");
+
+        //等待期间归还的连接能被等待方取到
+        std::thread giver([&]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(30));
+            pool->FreeConn(first);
+        });
+        Check(pool->GetSqlConn() == first, "waiter gets a returned connection");
+        giver.join();
+        Check(pool->GetStats().timeouts == 1, "no timeout when a connection is returned");
+
+        //还有借出的连接时拒绝重新Init, 连接池照常可用
+        Check(!pool->Init(config), "re-init rejected while connections are borrowed");
+        pool->FreeConn(first);
+        pool->FreeConn(second);
+        Check(pool->GetFreeConnCount() == 2, "borrowed connections returned after rejected re-init");
+        pool->Close();
+        Check(backend.GetOpenCount() == 0, "close releases every connection");
+    }
+
+    //空闲连接ping失败时关闭并重新建立, 连接总数不变
+    void CheckPingReconnect()
+    {
+        FakeBackend backend;
+        SqlConnPool::Config config = MakeConfig(backend, 2, 2);
+        config.ping_interval_ms = 20;
+
+        SqlConnPool *pool = SqlConnPool::Instance();
+        Check(pool->Init(config), "init for ping");
+        MYSQL *broken = pool->GetSqlConn(0);
+        {
+            std::lock_guard<std::mutex> locker(backend.mtx);
+            backend.dead.insert(broken);
+        }
+
+        pool->FreeConn(broken);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while(pool->GetStats().reconnects == 0 && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        SqlConnPool::Stats stats = pool->GetStats();
+        Check(stats.ping_failures == 1 && stats.reconnects == 1, "failed ping reconnects");
+        //重建的连接可能复用同一地址, 按关闭次数检查
+        Check(backend.GetCloseCount() == 1, "broken connection closed");
+        Check(stats.conn_num == 2 && backend.GetOpenCount() == 2, "connection count kept after reconnect");
+        pool->Close();
+    }
+}
+
+int main()
+{
+    CheckParallelWarmup();
+    CheckWarmupFailure();
+    CheckGrowth();
+    CheckIdleShrink();
+    CheckAcquireTimeout();
+    CheckPingReconnect();
+    if(failures == 0)
+    {
+        printf("sqlconnpool_test passed\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,132 @@
+//
+// Created by ciaowhen on 2023/5/26.
+//
+
+#include "../threadpool/sqlstmtcache.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+//预处理语句缓存要连真实的MySQL服务端, 由环境变量SQL_TEST_HOST/SQL_TEST_PORT/SQL_TEST_USER/SQL_TEST_PASSWORD/SQL_TEST_DB指定
+//没有设置SQL_TEST_HOST时返回77, ctest记为跳过
+namespace
+{
+    const int SKIP_CODE = 77;
+    int failures = 0;
+
+    void Check(bool ok, const char *what)
+    {
+        if(!ok)
+        {
+            fprintf(stderr, "FAILED: %s\n", what);
+            failures++;
+        }
+    }
+
+    const char *GetEnv(const char *name, const char *value)
+    {
+        const char *env = getenv(name);
+        return env ? env : value;
+    }
+
+    MYSQL *Connect(bool reconnect)
+    {
+        MYSQL *sql = mysql_init(nullptr);
+        if(!sql)
+        {
+            return nullptr;
+        }
+
+        bool enable = reconnect;
+        mysql_options(sql, MYSQL_OPT_RECONNECT, &enable);
+        if(!mysql_real_connect(sql, GetEnv("SQL_TEST_HOST", ""), GetEnv("SQL_TEST_USER", "root"), GetEnv("SQL_TEST_PASSWORD", ""),
+                               GetEnv("SQL_TEST_DB", ""), static_cast<unsigned int>(atoi(GetEnv("SQL_TEST_PORT", "3306"))), nullptr, 0))
+        {
+            fprintf(stderr, "connect failed: %s\n", mysql_error(sql));
+            mysql_close(sql);
+            return nullptr;
+        }
+
+        return sql;
+    }
+
+    //超出容量时关闭最久未用的语句, 命中的语句移到最近使用
+    void CheckLruEviction(MYSQL *sql)
+    {
+        SqlStmtCache cache(sql, 2);
+        MYSQL_STMT *first = cache.Prepare("SELECT 1");
+        MYSQL_STMT *second = cache.Prepare("SELECT 2");
+        Check(first && second && first != second, "prepare two statements");
+        Check(cache.Prepare("SELECT 1") == first, "cached statement reused");
+        Check(cache.GetHits() == 1 && cache.GetMisses() == 2, "hit and miss counts");
+
+        Check(cache.Prepare("SELECT 3") != nullptr && cache.GetSize() == 2, "capacity kept after eviction");
+        Check(cache.Prepare("SELECT 1") == first, "recently used statement survives eviction");
+        cache.Prepare("SELECT 2");
+        Check(cache.GetHits() == 2 && cache.GetMisses() == 4, "least recently used statement evicted");
+
+        long long value = 0;
+        MYSQL_STMT *stmt = cache.Execute("SELECT ? + 1", 41);
+        Check(stmt && SqlStmtCache::Fetch(stmt, value) && value == 42, "execute and fetch through the cache");
+        Check(stmt && !SqlStmtCache::Fetch(stmt, value), "no more rows");
+    }
+
+    //连接被服务端断开并自动重连后thread id变化, 缓存的语句全部作废, 下次使用时重新prepare
+    void CheckReconnectInvalidation(MYSQL *sql, MYSQL *admin)
+    {
+        SqlStmtCache cache(sql, 4);
+        long long value = 0;
+        MYSQL_STMT *stmt = cache.Execute("SELECT ? + 1", 1);
+        Check(stmt && SqlStmtCache::Fetch(stmt, value) && value == 2, "execute before reconnect");
+
+        unsigned long thread_id = mysql_thread_id(sql);
+        std::string kill = "KILL " + std::to_string(thread_id);
+        Check(mysql_query(admin, kill.c_str()) == 0, "kill test connection");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        //断开后的第一条命令可能只是发现连接已断, 第二次ping才完成重连
+        mysql_ping(sql);
+        Check(mysql_ping(sql) == 0 && mysql_thread_id(sql) != thread_id, "connection reconnected");
+
+        uint64_t misses = cache.GetMisses();
+        stmt = cache.Execute("SELECT ? + 1", 2);
+        Check(stmt && SqlStmtCache::Fetch(stmt, value) && value == 3, "execute after reconnect");
+        Check(cache.GetMisses() == misses + 1 && cache.GetSize() == 1, "statements prepared before reconnect dropped");
+    }
+}
+
+int main()
+{
+    if(!getenv("SQL_TEST_HOST"))
+    {
+        printf("sqlstmtcache_test skipped, SQL_TEST_HOST not set\n");
+        return SKIP_CODE;
+    }
+
+    MYSQL *sql = Connect(true);
+    MYSQL *admin = Connect(false);
+    Check(sql && admin, "connect to test server");
+    if(sql && admin)
+    {
+        CheckLruEviction(sql);
+        CheckReconnectInvalidation(sql, admin);
+    }
+
+    if(sql)
+    {
+        mysql_close(sql);
+    }
+
+    if(admin)
+    {
+        mysql_close(admin);
+    }
+
+    if(failures == 0)
+    {
+        printf("sqlstmtcache_test passed\n");
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -18,14 +18,29 @@ public:
         m_conn_pool = conn_pool;
     }
 
+    //最多等timeout_ms, 取不到时*sql为nullptr
+    SqlConnRAII(MYSQL **sql, SqlConnPool *conn_pool, int timeout_ms)
+    {
+        assert(conn_pool);
+        *sql = conn_pool->GetSqlConn(timeout_ms);
+        m_sql = *sql;
+        m_conn_pool = conn_pool;
+    }
+
     ~SqlConnRAII()
     {
         if(m_sql)
         {
-            m_conn_pool->FreeConn();
+            m_conn_pool->FreeConn(m_sql);
         }
     }
 
+    //当前连接的预处理语句缓存, 没有取到连接或未开启缓存时返回nullptr
+    SqlStmtCache *GetStmtCache()
+    {
+        return m_sql ? m_conn_pool->GetStmtCache(m_sql) : nullptr;
+    }
+
 private:
     MYSQL *m_sql;
     SqlConnPool *m_conn_pool;
@@ -4,60 +4,249 @@
 
 #include "sqlconnpool.h"
 #include "../log/log.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
+#include <ctime>
+#include <vector>
 
-SqlConnPool::SqlConnPool():m_conn_max_num(0), m_free_conn_num(0), m_use_conn_num(0)
+SqlConnPool::SqlConnPool():m_mysql_connector(true), m_closed(true), m_conn_max_num(0), m_conn_min_num(0), m_conn_num(0), m_use_conn_num(0),
+    m_acquired(0), m_timeouts(0), m_connect_failures(0), m_ping_failures(0), m_reconnects(0), m_stop(false)
 {
-
+    sem_init(&m_sem, 0, 0);
 }
 
 SqlConnPool::~SqlConnPool()
 {
     Close();
+    sem_destroy(&m_sem);
 }
 
-void SqlConnPool::Init(const char *host, int port, const char *username, const char *password, const char *dbname, int conn_num)
+bool SqlConnPool::Init(const char *host, int port, const char *username, const char *password, const char *dbname, int conn_num)
 {
     assert(conn_num > 0);
     assert(port > 1025 && port < 65535);
     assert(host != NULL && username != NULL && password != NULL && dbname != NULL);
 
-    for(int i = 0; i < conn_num; ++i)
+    Config config;
+    config.host = host;
+    config.port = port;
+    config.username = username;
+    config.password = password;
+    config.dbname = dbname;
+    config.max_conn_num = conn_num;
+    return Init(config);
+}
+
+bool SqlConnPool::Init(const Config &config)
+{
+    assert(config.max_conn_num > 0);
+    //还有借出(含正在新建)的连接时重置计数, 它们归还后在用数会变成负数, 总数会超过上限
+    //检查和置为关闭在同一次加锁内完成, 之间不会再借出连接
+    int use_conn_num = 0;
     {
-        MYSQL *sql = nullptr;
-        sql = mysql_init(sql);
-        if(!sql)
+        std::unique_lock<std::mutex> locker(m_mutex);
+        use_conn_num = m_use_conn_num;
+        if(use_conn_num == 0)
         {
-            LOG_ERROR("Mysql Init Error");
-            assert(sql);
+            CloseLocked(locker);
         }
+    }
+
+    if(use_conn_num > 0)
+    {
+        LOG_ERROR("SqlConnPool Init rejected, {} connections still in use", use_conn_num);
+        return false;
+    }
+
+    m_config = config;
+    m_mysql_connector = !config.connector.connect;
+    if(m_mysql_connector)
+    {
+        //多个线程同时mysql_init前必须先初始化客户端库
+        mysql_library_init(0, nullptr, nullptr);
+    }
+
+    int min_conn_num = config.min_conn_num < 0 ? config.max_conn_num : std::min(config.min_conn_num, config.max_conn_num);
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_closed = false;
+        m_stop = false;
+        m_conn_max_num = config.max_conn_num;
+        m_conn_min_num = min_conn_num;
+        m_conn_num = 0;
+        m_use_conn_num = 0;
+        m_acquired = 0;
+        m_timeouts = 0;
+        m_connect_failures = 0;
+        m_ping_failures = 0;
+        m_reconnects = 0;
+        m_acquire_wait_ns = HistogramSnapshot();
+    }
+
+    Warmup(min_conn_num, std::max(1, std::min(config.warmup_threads, min_conn_num)));
+    if(config.idle_timeout_ms > 0 || config.ping_interval_ms > 0)
+    {
+        m_maintain_thread = std::thread(&SqlConnPool::MaintainThread, this);
+    }
+
+    int conn_num = GetConnCount();
+    if(conn_num < min_conn_num)
+    {
+        LOG_ERROR("SqlConnPool warmup opened {} of {} connections", conn_num, min_conn_num);
+        return false;
+    }
+
+    return true;
+}
 
-        sql = mysql_real_connect(sql, host, username, password, dbname, port, nullptr, 0);
+//thread_num个线程分摊建立conn_num个连接, 全部结束后返回; 失败的连接只记录日志
+void SqlConnPool::Warmup(int conn_num, int thread_num)
+{
+    std::atomic<int> remain(conn_num);
+    auto open = [this, &remain]
+    {
+        while(remain.fetch_sub(1, std::memory_order_relaxed) > 0)
+        {
+            MYSQL *sql = Connect();
+            if(!sql)
+            {
+                continue;
+            }
+
+            auto now = std::chrono::steady_clock::now();
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_sql_queue.push_back({sql, now, now});
+            m_conn_num++;
+            sem_post(&m_sem);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int i = 1; i < thread_num; ++i)
+    {
+        threads.emplace_back([this, &open]
+        {
+            open();
+            if(m_mysql_connector)
+            {
+                mysql_thread_end();
+            }
+        });
+    }
+
+    //当前线程也参与, 只有一个线程时就是逐个建立
+    open();
+    for(auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+MYSQL *SqlConnPool::Connect()
+{
+    MYSQL *sql = nullptr;
+    if(!m_mysql_connector)
+    {
+        sql = m_config.connector.connect();
         if(!sql)
         {
             LOG_ERROR("Mysql Connect Error");
-            assert(sql);
         }
+    }
+    else if(!(sql = mysql_init(nullptr)))
+    {
+        LOG_ERROR("Mysql Init Error");
+    }
+    else if(!mysql_real_connect(sql, m_config.host.c_str(), m_config.username.c_str(), m_config.password.c_str(), m_config.dbname.c_str(), m_config.port, nullptr, 0))
+    {
+        LOG_ERROR("Mysql Connect Error: {}", mysql_error(sql));
+        mysql_close(sql);
+        sql = nullptr;
+    }
+
+    if(!sql)
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        m_connect_failures++;
+    }
+
+    return sql;
+}
+
+void SqlConnPool::CloseConn(MYSQL *sql)
+{
+    //语句要在连接关闭前释放
+    std::unique_ptr<SqlStmtCache> cache;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        auto iter = m_stmt_caches.find(sql);
+        if(iter != m_stmt_caches.end())
+        {
+            cache = std::move(iter->second);
+            m_stmt_caches.erase(iter);
+        }
+    }
 
-        m_sql_queue.emplace(sql);
+    cache.reset();
+    if(m_mysql_connector)
+    {
+        mysql_close(sql);
+    }
+    else if(m_config.connector.close)
+    {
+        m_config.connector.close(sql);
+    }
+}
+
+bool SqlConnPool::PingConn(MYSQL *sql)
+{
+    if(m_mysql_connector)
+    {
+        return mysql_ping(sql) == 0;
     }
 
-    sem_init(&m_sem, 0, conn_num);
-    m_conn_max_num = conn_num;
-    m_free_conn_num = conn_num;
+    return !m_config.connector.ping || m_config.connector.ping(sql);
 }
 
 void SqlConnPool::Close()
 {
-    std::lock_guard<std::mutex> locker(m_mutex);
-    while(!m_sql_queue.empty())
+    std::unique_lock<std::mutex> locker(m_mutex);
+    CloseLocked(locker);
+}
+
+//在调用方的加锁内置为关闭并取走空闲连接, 随后放开锁等维护线程退出, 再关闭取走的连接
+//维护线程正在检测的连接回来时看到已关闭, 由它自己关闭
+void SqlConnPool::CloseLocked(std::unique_lock<std::mutex> &locker)
+{
+    bool was_open = !m_closed;
+    std::deque<IdleConn> idle;
+    m_stop = true;
+    m_closed = true;
+    m_maintain_cond.notify_all();
+    idle.swap(m_sql_queue);
+    for(size_t i = 0; i < idle.size(); ++i)
     {
-        auto close_sql = m_sql_queue.front();
-        m_sql_queue.pop();
-        mysql_close(close_sql);
+        sem_trywait(&m_sem);
     }
 
-    mysql_library_end();
+    m_conn_num -= static_cast<int>(idle.size());
+    locker.unlock();
+    if(m_maintain_thread.joinable())
+    {
+        m_maintain_thread.join();
+    }
+
+    for(auto &conn : idle)
+    {
+        CloseConn(conn.sql);
+    }
+
+    if(was_open && m_mysql_connector)
+    {
+        mysql_library_end();
+    }
 }
 
 SqlConnPool* SqlConnPool::Instance()
@@ -68,21 +257,108 @@ SqlConnPool* SqlConnPool::Instance()
 
 MYSQL* SqlConnPool::GetSqlConn()
 {
-    MYSQL *sql_conn = nullptr;
-    if(m_sql_queue.empty())
-    {
-        LOG_WARN("SqlConnPool is Busy");
-        return nullptr;
-    }
+    return GetSqlConn(m_config.acquire_timeout_ms);
+}
 
-    sem_wait(&m_sem);
+//有空闲连接时取最近归还的一个; 没有时未到上限就在锁外新建一个, 否则用sem_timedwait分段等到期限
+MYSQL* SqlConnPool::GetSqlConn(int timeout_ms)
+{
+    auto begin = std::chrono::steady_clock::now();
+    auto deadline = begin + std::chrono::milliseconds(timeout_ms);
+    while(true)
     {
-        std::lock_guard<std::mutex> locker(m_mutex);
-        sql_conn = m_sql_queue.front();
-        m_sql_queue.pop();
-        m_use_conn_num++;
+        bool grow = false;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if(m_closed)
+            {
+                return nullptr;
+            }
+
+            if(sem_trywait(&m_sem) == 0)
+            {
+                return TakeLocked(begin);
+            }
+
+            if(m_conn_num < m_conn_max_num)
+            {
+                //先占住名额, 其他线程不会超建; 正在新建的连接也算借出, 期间不能重新Init
+                m_conn_num++;
+                m_use_conn_num++;
+                grow = true;
+            }
+        }
+
+        if(grow)
+        {
+            MYSQL *sql_conn = Connect();
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                if(sql_conn && !m_closed)
+                {
+                    m_acquired++;
+                    m_acquire_wait_ns.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()));
+                    return sql_conn;
+                }
+
+                m_conn_num--;
+                m_use_conn_num--;
+            }
+
+            //新建期间连接池已关闭
+            if(sql_conn)
+            {
+                CloseConn(sql_conn);
+                return nullptr;
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if(timeout_ms >= 0 && now >= deadline)
+        {
+            {
+                std::lock_guard<std::mutex> locker(m_mutex);
+                m_timeouts++;
+            }
+
+            //日志可能阻塞, 不能拖着连接池的锁
+            LOG_WARN("SqlConnPool is Busy");
+            return nullptr;
+        }
+
+        auto until = now + std::chrono::milliseconds(ACQUIRE_SLICE_MS);
+        if(timeout_ms >= 0 && deadline < until)
+        {
+            until = deadline;
+        }
+
+        //sem_timedwait只接受CLOCK_REALTIME的绝对时间
+        int64_t wait_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(until - now).count();
+        struct timespec abs_time;
+        clock_gettime(CLOCK_REALTIME, &abs_time);
+        abs_time.tv_sec += static_cast<time_t>((abs_time.tv_nsec + wait_ns) / 1000000000);
+        abs_time.tv_nsec = static_cast<long>((abs_time.tv_nsec + wait_ns) % 1000000000);
+        if(sem_timedwait(&m_sem, &abs_time) == 0)
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if(m_closed)
+            {
+                return nullptr;
+            }
+
+            return TakeLocked(begin);
+        }
     }
+}
 
+//调用方已扣减信号量
+MYSQL *SqlConnPool::TakeLocked(std::chrono::steady_clock::time_point begin)
+{
+    MYSQL *sql_conn = m_sql_queue.back().sql;
+    m_sql_queue.pop_back();
+    m_use_conn_num++;
+    m_acquired++;
+    m_acquire_wait_ns.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count()));
     return sql_conn;
 }
 
@@ -95,12 +371,37 @@ void SqlConnPool::FreeConn(MYSQL *sql)
 
     {
         std::lock_guard<std::mutex> locker(m_mutex);
-        m_sql_queue.emplace(sql);
-        m_free_conn_num++;
-        sem_post(&m_sem);
+        m_use_conn_num--;
+        if(!m_closed)
+        {
+            auto now = std::chrono::steady_clock::now();
+            m_sql_queue.push_back({sql, now, now});
+            sem_post(&m_sem);
+            return;
+        }
+
+        m_conn_num--;
     }
 
-    return;
+    //连接池已关闭, 借出的连接归还时直接关闭
+    CloseConn(sql);
+}
+
+SqlStmtCache *SqlConnPool::GetStmtCache(MYSQL *sql)
+{
+    if(!sql || m_config.stmt_cache_size <= 0)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    std::unique_ptr<SqlStmtCache> &cache = m_stmt_caches[sql];
+    if(!cache)
+    {
+        cache.reset(new SqlStmtCache(sql, static_cast<size_t>(m_config.stmt_cache_size)));
+    }
+
+    return cache.get();
 }
 
 int SqlConnPool::GetFreeConnCount()
@@ -109,4 +410,183 @@ int SqlConnPool::GetFreeConnCount()
     return m_sql_queue.size();
 }
 
+int SqlConnPool::GetConnCount()
+{
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_conn_num;
+}
+
+SqlConnPool::Stats SqlConnPool::GetStats()
+{
+    Stats stats;
+    std::lock_guard<std::mutex> locker(m_mutex);
+    stats.conn_num = m_conn_num;
+    stats.use_conn_num = m_use_conn_num;
+    stats.free_conn_num = static_cast<int>(m_sql_queue.size());
+    stats.max_conn_num = m_conn_max_num;
+    stats.acquired = m_acquired;
+    stats.timeouts = m_timeouts;
+    stats.connect_failures = m_connect_failures;
+    stats.ping_failures = m_ping_failures;
+    stats.reconnects = m_reconnects;
+    stats.acquire_wait_ns = m_acquire_wait_ns;
+    return stats;
+}
 
+double SqlConnPool::Stats::GetUtilization() const
+{
+    return max_conn_num > 0 ? static_cast<double>(use_conn_num) / max_conn_num : 0;
+}
+
+std::string SqlConnPool::Stats::ToString() const
+{
+    std::string text;
+    char line[512];
+    snprintf(line, sizeof(line), "sqlpool_conn_num %d\nsqlpool_use_conn_num %d\nsqlpool_free_conn_num %d\nsqlpool_max_conn_num %d\nsqlpool_utilization %g\n",
+             conn_num, use_conn_num, free_conn_num, max_conn_num, GetUtilization());
+    text += line;
+    snprintf(line, sizeof(line), "sqlpool_acquired %lu\nsqlpool_timeouts %lu\nsqlpool_connect_failures %lu\nsqlpool_ping_failures %lu\nsqlpool_reconnects %lu\n",
+             static_cast<unsigned long>(acquired), static_cast<unsigned long>(timeouts), static_cast<unsigned long>(connect_failures),
+             static_cast<unsigned long>(ping_failures), static_cast<unsigned long>(reconnects));
+    text += line;
+    acquire_wait_ns.AppendTo(text, "sqlpool_acquire_wait_ns");
+    return text;
+}
+
+//关闭空闲超时的连接, 连接总数不少于m_conn_min_num
+void SqlConnPool::ShrinkIdle()
+{
+    auto expire = std::chrono::steady_clock::now() - std::chrono::milliseconds(m_config.idle_timeout_ms);
+    std::vector<MYSQL *> expired;
+    {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        while(!m_sql_queue.empty() && m_conn_num > m_conn_min_num && m_sql_queue.front().since <= expire)
+        {
+            //与GetSqlConn一样先扣信号量, 保证信号量不多于队列长度
+            if(sem_trywait(&m_sem) != 0)
+            {
+                break;
+            }
+
+            expired.push_back(m_sql_queue.front().sql);
+            m_sql_queue.pop_front();
+            m_conn_num--;
+        }
+    }
+
+    for(MYSQL *sql : expired)
+    {
+        CloseConn(sql);
+    }
+}
+
+//到期该检测的空闲连接一次取出一个在锁外ping, 检测完立即放回, 其余空闲连接照常可借; 断开的关闭后重新建立, 建立失败的从连接池中去掉
+void SqlConnPool::CheckIdle()
+{
+    auto stale = std::chrono::steady_clock::now() - std::chrono::milliseconds(m_config.ping_interval_ms);
+    while(true)
+    {
+        IdleConn conn;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if(m_closed || m_stop)
+            {
+                return;
+            }
+
+            auto iter = std::find_if(m_sql_queue.begin(), m_sql_queue.end(), [&stale](const IdleConn &idle){ return idle.checked <= stale; });
+            //扣不到信号量说明有线程正要取走空闲连接, 留到下次
+            if(iter == m_sql_queue.end() || sem_trywait(&m_sem) != 0)
+            {
+                return;
+            }
+
+            conn = *iter;
+            m_sql_queue.erase(iter);
+        }
+
+        bool alive = PingConn(conn.sql);
+        if(!alive)
+        {
+            LOG_WARN("SqlConnPool ping failed, reconnecting");
+            CloseConn(conn.sql);
+            conn.sql = Connect();
+        }
+
+        conn.checked = std::chrono::steady_clock::now();
+        MYSQL *closing = nullptr;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if(!alive)
+            {
+                m_ping_failures++;
+                m_reconnects += conn.sql ? 1 : 0;
+            }
+
+            if(!conn.sql)
+            {
+                m_conn_num--;
+            }
+            else if(m_closed)
+            {
+                closing = conn.sql;
+                m_conn_num--;
+            }
+            else
+            {
+                //放回头部, 保持按归还时间排列, 空闲收缩仍然从头部开始
+                m_sql_queue.push_front(conn);
+                sem_post(&m_sem);
+            }
+        }
+
+        if(closing)
+        {
+            CloseConn(closing);
+        }
+    }
+}
+
+void SqlConnPool::MaintainThread()
+{
+    int interval_ms = 1000;
+    if(m_config.idle_timeout_ms > 0)
+    {
+        interval_ms = std::min(interval_ms, m_config.idle_timeout_ms / 2);
+    }
+
+    if(m_config.ping_interval_ms > 0)
+    {
+        interval_ms = std::min(interval_ms, m_config.ping_interval_ms / 2);
+    }
+
+    auto interval = std::chrono::milliseconds(std::max(interval_ms, 10));
+    std::unique_lock<std::mutex> locker(m_mutex);
+    while(!m_stop)
+    {
+        m_maintain_cond.wait_for(locker, interval);
+        if(m_stop)
+        {
+            break;
+        }
+
+        locker.unlock();
+        if(m_config.idle_timeout_ms > 0)
+        {
+            ShrinkIdle();
+        }
+
+        if(m_config.ping_interval_ms > 0)
+        {
+            CheckIdle();
+        }
+
+        locker.lock();
+    }
+
+    locker.unlock();
+    if(m_mysql_connector)
+    {
+        mysql_thread_end();
+    }
+}
@@ -9,31 +9,125 @@
 #include <string>
 #include <mutex>
 #include <thread>
-#include <queue>
+#include <deque>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <condition_variable>
 #include <semaphore.h>
+#include "taskstats.h"
+#include "sqlstmtcache.h"
 
 class SqlConnPool
 {
 public:
-    void Init(const char *host, int port, const char *username, const char *password, const char *dbname, int conn_num);
+    //建立与关闭连接的钩子, 为空时使用MySQL客户端库, 测试时可以换成本地的假后端
+    struct Connector
+    {
+        std::function<MYSQL *()> connect;               //失败返回nullptr, 可能被多个线程同时调用
+        std::function<void(MYSQL *)> close;
+        std::function<bool(MYSQL *)> ping;              //连接是否可用; 使用自定义connect且ping为空时不做检测
+    };
+
+    struct Config
+    {
+        std::string host;
+        int port = 3306;
+        std::string username;
+        std::string password;
+        std::string dbname;
+        int max_conn_num = 8;
+        int min_conn_num = -1;                          //Init时建立的连接数, 小于0时等于max_conn_num; 之后按需增长到max_conn_num
+        int warmup_threads = 4;                         //Init时并行建立连接的线程数, 1为逐个建立
+        int idle_timeout_ms = 0;                        //多于min_conn_num的连接空闲超过该时间后关闭, 0为不收缩
+        int ping_interval_ms = 0;                       //空闲连接每隔该时间检测一次, 断开的重新建立, 0为不检测
+        int acquire_timeout_ms = 0;                     //GetSqlConn()没有可用连接时的等待时间, 0为不等待, 小于0为一直等
+        int stmt_cache_size = 32;                       //每个连接缓存的预处理语句数, 0为不缓存
+        Connector connector;
+    };
+
+    //GetStats的返回值, ToString输出"名字 值"格式的文本, 与TaskStatsSnapshot一致
+    struct Stats
+    {
+        int conn_num = 0;
+        int use_conn_num = 0;                           //已借出的连接数, 含正在为借用方新建的
+        int free_conn_num = 0;
+        int max_conn_num = 0;
+        uint64_t acquired = 0;
+        uint64_t timeouts = 0;                          //等到期限仍没有连接的次数
+        uint64_t connect_failures = 0;
+        uint64_t ping_failures = 0;
+        uint64_t reconnects = 0;                        //检测失败后重新建立成功的次数
+        HistogramSnapshot acquire_wait_ns;              //成功取得连接的等待时间, 不含超时
+
+        double GetUtilization() const;                  //已借出连接占上限的比例
+        std::string ToString() const;
+    };
+
+    //建立了min_conn_num个连接时返回true, 否则连接池仍可用, 缺少的连接在GetSqlConn时补建
+    //还有借出的连接时不能重新Init, 直接返回false
+    bool Init(const Config &config);
+    bool Init(const char *host, int port, const char *username, const char *password, const char *dbname, int conn_num);
     void Close();
 
     static SqlConnPool *Instance();
-    MYSQL *GetSqlConn();
+    MYSQL *GetSqlConn();                                //等待Config::acquire_timeout_ms
+    MYSQL *GetSqlConn(int timeout_ms);                  //0为不等待, 小于0为一直等; 超时或已关闭返回nullptr
     void FreeConn(MYSQL *sql);
     int GetFreeConnCount();
+    int GetConnCount();                                 //已建立(含正在建立)的连接数
+    Stats GetStats();
+    //借出连接上的预处理语句缓存, 第一次使用时创建, 连接关闭(含检测失败重连)时一起释放; 未开启时返回nullptr
+    SqlStmtCache *GetStmtCache(MYSQL *sql);
 
 private:
     SqlConnPool();
     ~SqlConnPool();
 
-    int m_conn_max_num;     //连接池连接数量
-    int m_free_conn_num;    //连接池当前空闲连接数
+    static constexpr int ACQUIRE_SLICE_MS = 100;        //分段等待, 期间连接数降到上限以下时可以新建连接
+
+    struct IdleConn
+    {
+        MYSQL *sql;
+        std::chrono::steady_clock::time_point since;    //归还的时间
+        std::chrono::steady_clock::time_point checked;  //上次检测的时间
+    };
+
+    MYSQL *Connect();
+    void CloseLocked(std::unique_lock<std::mutex> &locker);
+    void CloseConn(MYSQL *sql);
+    bool PingConn(MYSQL *sql);
+    void Warmup(int conn_num, int thread_num);
+    MYSQL *TakeLocked(std::chrono::steady_clock::time_point begin);
+    void ShrinkIdle();
+    void CheckIdle();
+    void MaintainThread();
+
+    Config m_config;
+    bool m_mysql_connector;                             //使用MySQL客户端库而不是自定义钩子
+    bool m_closed;
+    int m_conn_max_num;     //连接池连接数量上限
+    int m_conn_min_num;     //空闲收缩时保留的连接数
+    int m_conn_num;         //连接池当前连接总数
     int m_use_conn_num;     //连接池当前已用连接数
 
-    std::queue<MYSQL *> m_sql_queue;
-    sem_t m_sem;
+    std::deque<IdleConn> m_sql_queue;                   //空闲连接, 从尾部取用和归还, 头部是空闲最久的
+    sem_t m_sem;                                        //空闲连接数, 只在持有m_mutex时增加, 不多于m_sql_queue的长度
     std::mutex m_mutex;
+
+    //以下计数由m_mutex保护
+    uint64_t m_acquired;
+    uint64_t m_timeouts;
+    uint64_t m_connect_failures;
+    uint64_t m_ping_failures;
+    uint64_t m_reconnects;
+    HistogramSnapshot m_acquire_wait_ns;
+    std::unordered_map<MYSQL *, std::unique_ptr<SqlStmtCache>> m_stmt_caches;
+
+    std::thread m_maintain_thread;
+    std::condition_variable m_maintain_cond;
+    bool m_stop;
 };
 
 
@@ -0,0 +1,193 @@
+//
+// Created by ciaowhen on 2023/5/24.
+//
+
+#include "sqlstmtcache.h"
+#include "../log/log.h"
+#include <mysql/mysqld_error.h>
+#include <algorithm>
+#include <cassert>
+
+SqlStmtCache::SqlStmtCache(MYSQL *sql, size_t capacity):m_sql(sql), m_capacity(capacity > 0 ? capacity : 1),
+    m_thread_id(mysql_thread_id(sql)), m_hits(0), m_misses(0)
+{
+}
+
+SqlStmtCache::~SqlStmtCache()
+{
+    Clear();
+}
+
+MYSQL_STMT *SqlStmtCache::Prepare(const std::string &sql_text)
+{
+    //开启自动重连时mysql_ping可能悄悄换了连接, 旧语句在服务端已不存在
+    unsigned long thread_id = mysql_thread_id(m_sql);
+    if(thread_id != m_thread_id)
+    {
+        Clear();
+        m_thread_id = thread_id;
+    }
+
+    auto iter = m_stmts.find(sql_text);
+    if(iter != m_stmts.end())
+    {
+        m_hits++;
+        m_lru.splice(m_lru.begin(), m_lru, iter->second);
+        return iter->second->second;
+    }
+
+    m_misses++;
+    MYSQL_STMT *stmt = mysql_stmt_init(m_sql);
+    if(!stmt)
+    {
+        LOG_ERROR("Mysql Stmt Init Error: {}", mysql_error(m_sql));
+        return nullptr;
+    }
+
+    if(mysql_stmt_prepare(stmt, sql_text.data(), static_cast<unsigned long>(sql_text.size())))
+    {
+        LOG_ERROR("Mysql Prepare Error: {}", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+
+    if(m_lru.size() >= m_capacity)
+    {
+        mysql_stmt_close(m_lru.back().second);
+        m_stmts.erase(m_lru.back().first);
+        m_lru.pop_back();
+    }
+
+    m_lru.emplace_front(sql_text, stmt);
+    m_stmts[sql_text] = m_lru.begin();
+    return stmt;
+}
+
+void SqlStmtCache::Clear()
+{
+    for(auto &entry : m_lru)
+    {
+        mysql_stmt_close(entry.second);
+    }
+
+    m_lru.clear();
+    m_stmts.clear();
+}
+
+size_t SqlStmtCache::GetSize() const
+{
+    return m_lru.size();
+}
+
+uint64_t SqlStmtCache::GetHits() const
+{
+    return m_hits;
+}
+
+uint64_t SqlStmtCache::GetMisses() const
+{
+    return m_misses;
+}
+
+void SqlStmtCache::Erase(const std::string &sql_text)
+{
+    auto iter = m_stmts.find(sql_text);
+    if(iter == m_stmts.end())
+    {
+        return;
+    }
+
+    mysql_stmt_close(iter->second->second);
+    m_lru.erase(iter->second);
+    m_stmts.erase(iter);
+}
+
+SqlStmtCache::EXECUTE_RESULT SqlStmtCache::ExecuteBound(MYSQL_STMT *stmt, MYSQL_BIND *binds, size_t count)
+{
+    if(mysql_stmt_param_count(stmt) != count)
+    {
+        LOG_ERROR("Mysql Stmt expects {} params, got {}", mysql_stmt_param_count(stmt), count);
+        return ER_FAILED;
+    }
+
+    //上次执行没取完的结果要先丢掉, 否则连接上的命令会乱序
+    mysql_stmt_free_result(stmt);
+    if((count == 0 || !mysql_stmt_bind_param(stmt, binds)) && !mysql_stmt_execute(stmt) && !mysql_stmt_store_result(stmt))
+    {
+        return ER_OK;
+    }
+
+    //只有服务端丢了语句时重新prepare才有用; 断线时在同一个MYSQL上重试只会再失败一次, 交给连接池检测后重连
+    unsigned int error = mysql_stmt_errno(stmt);
+    LOG_WARN("Mysql Stmt Execute Error: {}", mysql_stmt_error(stmt));
+    if(error == ER_UNKNOWN_STMT_HANDLER || error == ER_NEED_REPREPARE)
+    {
+        return ER_STALE;
+    }
+
+    return ER_FAILED;
+}
+
+//列数对不上是调用方的错误, 不能和取完结果一样安静地返回false
+bool SqlStmtCache::CheckFieldCount(MYSQL_STMT *stmt, size_t count)
+{
+    unsigned int field_count = mysql_stmt_field_count(stmt);
+    if(field_count == count)
+    {
+        return true;
+    }
+
+    LOG_ERROR("Mysql Fetch expects {} columns, result has {}", count, field_count);
+    assert(field_count == count);
+    return false;
+}
+
+bool SqlStmtCache::FetchBound(MYSQL_STMT *stmt, MYSQL_BIND *binds)
+{
+    if(mysql_stmt_bind_result(stmt, binds))
+    {
+        LOG_ERROR("Mysql Bind Result Error: {}", mysql_stmt_error(stmt));
+        return false;
+    }
+
+    //字符串列没有缓冲区, 一定会报截断, 之后逐列读出
+    int ret = mysql_stmt_fetch(stmt);
+    if(ret == 0 || ret == MYSQL_DATA_TRUNCATED)
+    {
+        return true;
+    }
+
+    if(ret == 1)
+    {
+        LOG_ERROR("Mysql Fetch Error: {}", mysql_stmt_error(stmt));
+    }
+
+    return false;
+}
+
+bool SqlStmtCache::FetchString(MYSQL_STMT *stmt, unsigned int column, const BindValue &value, std::string &out)
+{
+    out.clear();
+    if(value.is_null || value.length == 0)
+    {
+        return true;
+    }
+
+    out.resize(value.length);
+    MYSQL_BIND bind;
+    memset(&bind, 0, sizeof(bind));
+    unsigned long length = 0;
+    bind.buffer_type = MYSQL_TYPE_STRING;
+    bind.buffer = &out[0];
+    bind.buffer_length = value.length;
+    bind.length = &length;
+    if(mysql_stmt_fetch_column(stmt, &bind, column, 0))
+    {
+        LOG_ERROR("Mysql Fetch Column Error: {}", mysql_stmt_error(stmt));
+        out.clear();
+        return false;
+    }
+
+    out.resize(std::min<unsigned long>(length, value.length));
+    return true;
+}
@@ -0,0 +1,197 @@
+//
+// Created by ciaowhen on 2023/5/24.
+//
+
+#ifndef ADVANCECODE_SQLSTMTCACHE_H
+#define ADVANCECODE_SQLSTMTCACHE_H
+
+#include <mysql/mysql.h>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+//每个池化连接一份的预处理语句缓存, 以SQL文本为键按LRU淘汰; 只由借到该连接的线程使用, 不加锁
+//连接重连后(mysql_thread_id变化)缓存的语句全部失效, 下次使用时重新prepare
+class SqlStmtCache
+{
+public:
+    SqlStmtCache(MYSQL *sql, size_t capacity);
+    ~SqlStmtCache();
+    SqlStmtCache(const SqlStmtCache &) = delete;
+    SqlStmtCache &operator=(const SqlStmtCache &) = delete;
+
+    //取得已prepare的语句, 没有时prepare后放入缓存, 超出容量时关闭最久未用的; 失败返回nullptr
+    MYSQL_STMT *Prepare(const std::string &sql_text);
+    //按参数类型绑定后执行, 结果集缓存在客户端; 服务端丢了语句时重新prepare并重试一次, 断线不重试. 失败返回nullptr
+    //参数支持整数, bool, 浮点数, std::string/std::string_view/const char*与nullptr(NULL)
+    template<class... Args>
+    MYSQL_STMT *Execute(const std::string &sql_text, const Args&... args);
+    //取结果集的下一行, 列依次存入outs, 支持整数, 浮点数与std::string, NULL存为0或空串; 没有更多行或出错返回false
+    //outs个数与结果列数不符是用法错误, 记录日志并断言
+    template<class... Outs>
+    static bool Fetch(MYSQL_STMT *stmt, Outs&... outs);
+
+    void Clear();
+    size_t GetSize() const;
+    uint64_t GetHits() const;
+    uint64_t GetMisses() const;
+
+private:
+    typedef std::remove_pointer<decltype(MYSQL_BIND::is_null)>::type BindFlag;
+
+    enum EXECUTE_RESULT
+    {
+        ER_OK = 0,
+        ER_STALE,                                       //语句已失效, 重新prepare后可以重试
+        ER_FAILED,
+    };
+
+    //MYSQL_BIND只保存指针, 值放在这里
+    struct BindValue
+    {
+        long long i = 0;
+        double d = 0;
+        unsigned long length = 0;
+        BindFlag is_null = 0;
+    };
+
+    EXECUTE_RESULT ExecuteBound(MYSQL_STMT *stmt, MYSQL_BIND *binds, size_t count);
+    void Erase(const std::string &sql_text);
+    static bool CheckFieldCount(MYSQL_STMT *stmt, size_t count);
+    static bool FetchBound(MYSQL_STMT *stmt, MYSQL_BIND *binds);
+    static bool FetchString(MYSQL_STMT *stmt, unsigned int column, const BindValue &value, std::string &out);
+
+    template<class T>
+    static typename std::enable_if<std::is_integral<T>::value>::type BindParam(MYSQL_BIND &bind, BindValue &value, const T &arg)
+    {
+        value.i = static_cast<long long>(arg);
+        bind.buffer_type = MYSQL_TYPE_LONGLONG;
+        bind.buffer = &value.i;
+        bind.is_unsigned = std::is_unsigned<T>::value;
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type BindParam(MYSQL_BIND &bind, BindValue &value, const T &arg)
+    {
+        value.d = static_cast<double>(arg);
+        bind.buffer_type = MYSQL_TYPE_DOUBLE;
+        bind.buffer = &value.d;
+    }
+
+    static void BindParam(MYSQL_BIND &bind, BindValue &value, std::string_view arg)
+    {
+        value.length = static_cast<unsigned long>(arg.size());
+        bind.buffer_type = MYSQL_TYPE_STRING;
+        bind.buffer = const_cast<char *>(arg.data());
+        bind.buffer_length = value.length;
+        bind.length = &value.length;
+    }
+
+    static void BindParam(MYSQL_BIND &bind, BindValue &, std::nullptr_t)
+    {
+        bind.buffer_type = MYSQL_TYPE_NULL;
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_integral<T>::value>::type BindResult(MYSQL_BIND &bind, BindValue &value, T &)
+    {
+        bind.buffer_type = MYSQL_TYPE_LONGLONG;
+        bind.buffer = &value.i;
+        bind.is_unsigned = std::is_unsigned<T>::value;
+        bind.is_null = &value.is_null;
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_floating_point<T>::value>::type BindResult(MYSQL_BIND &bind, BindValue &value, T &)
+    {
+        bind.buffer_type = MYSQL_TYPE_DOUBLE;
+        bind.buffer = &value.d;
+        bind.is_null = &value.is_null;
+    }
+
+    //字符串列先不给缓冲区, 取到长度后再用mysql_stmt_fetch_column读出
+    static void BindResult(MYSQL_BIND &bind, BindValue &value, std::string &)
+    {
+        bind.buffer_type = MYSQL_TYPE_STRING;
+        bind.length = &value.length;
+        bind.is_null = &value.is_null;
+    }
+
+    template<class T>
+    static typename std::enable_if<std::is_arithmetic<T>::value, bool>::type StoreResult(MYSQL_STMT *, unsigned int, const BindValue &value, T &out)
+    {
+        out = value.is_null ? T() : std::is_floating_point<T>::value ? static_cast<T>(value.d) : static_cast<T>(value.i);
+        return true;
+    }
+
+    static bool StoreResult(MYSQL_STMT *stmt, unsigned int column, const BindValue &value, std::string &out)
+    {
+        return FetchString(stmt, column, value, out);
+    }
+
+private:
+    MYSQL *m_sql;
+    size_t m_capacity;
+    unsigned long m_thread_id;                          //prepare时连接的线程id, 变化说明连接已重连
+    std::list<std::pair<std::string, MYSQL_STMT *>> m_lru;     //头部为最近使用
+    std::unordered_map<std::string, std::list<std::pair<std::string, MYSQL_STMT *>>::iterator> m_stmts;
+    uint64_t m_hits;
+    uint64_t m_misses;
+};
+
+template<class... Args>
+MYSQL_STMT *SqlStmtCache::Execute(const std::string &sql_text, const Args&... args)
+{
+    for(int attempt = 0; attempt < 2; ++attempt)
+    {
+        MYSQL_STMT *stmt = Prepare(sql_text);
+        if(!stmt)
+        {
+            return nullptr;
+        }
+
+        //多留一个位置, 没有参数时数组也不为空
+        MYSQL_BIND binds[sizeof...(Args) + 1];
+        BindValue values[sizeof...(Args) + 1];
+        memset(binds, 0, sizeof(binds));
+        size_t index = 0;
+        (void)index;
+        ((BindParam(binds[index], values[index], args), ++index), ...);
+
+        EXECUTE_RESULT result = ExecuteBound(stmt, binds, sizeof...(Args));
+        if(result != ER_STALE)
+        {
+            return result == ER_OK ? stmt : nullptr;
+        }
+
+        Erase(sql_text);
+    }
+
+    return nullptr;
+}
+
+template<class... Outs>
+bool SqlStmtCache::Fetch(MYSQL_STMT *stmt, Outs&... outs)
+{
+    MYSQL_BIND binds[sizeof...(Outs) + 1];
+    BindValue values[sizeof...(Outs) + 1];
+    memset(binds, 0, sizeof(binds));
+    size_t index = 0;
+    ((BindResult(binds[index], values[index], outs), ++index), ...);
+    if(!CheckFieldCount(stmt, sizeof...(Outs)) || !FetchBound(stmt, binds))
+    {
+        return false;
+    }
+
+    unsigned int column = 0;
+    bool ok = true;
+    ((ok = StoreResult(stmt, column, values[column], outs) && ok, ++column), ...);
+    return ok;
+}
+
+#endif //ADVANCECODE_SQLSTMTCACHE_H
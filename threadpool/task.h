@@ -0,0 +1,165 @@
+//
+// Created by ciaowhen on 2023/5/14.
+//
+
+#ifndef ADVANCECODE_TASK_H
+#define ADVANCECODE_TASK_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+//只可移动的任务对象, 代替std::function<void()>
+//可调用对象不超过INLINE_SIZE且可无异常移动时直接放在对象内部, 否则才在堆上分配
+class Task
+{
+public:
+    static const size_t INLINE_SIZE = 120;
+
+    Task() noexcept : m_ops(nullptr) {}
+    Task(std::nullptr_t) noexcept : m_ops(nullptr) {}
+
+    template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F &&func) : m_ops(nullptr)
+    {
+        typedef typename std::decay<F>::type Func;
+        if constexpr(IsInlineable<Func>())
+        {
+            new (m_storage) Func(std::forward<F>(func));
+            m_ops = &InlineOps<Func>::ops;
+        }
+        else
+        {
+            *reinterpret_cast<Func **>(m_storage) = new Func(std::forward<F>(func));
+            m_ops = &HeapOps<Func>::ops;
+        }
+    }
+
+    Task(Task &&other) noexcept : m_ops(other.m_ops)
+    {
+        if(m_ops)
+        {
+            m_ops->move(m_storage, other.m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+
+    Task &operator=(Task &&other) noexcept
+    {
+        if(this != &other)
+        {
+            Reset();
+            if(other.m_ops)
+            {
+                m_ops = other.m_ops;
+                m_ops->move(m_storage, other.m_storage);
+                other.m_ops = nullptr;
+            }
+        }
+
+        return *this;
+    }
+
+    Task &operator=(std::nullptr_t) noexcept
+    {
+        Reset();
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        Reset();
+    }
+
+    void operator()()
+    {
+        m_ops->invoke(m_storage);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return m_ops != nullptr;
+    }
+
+    bool IsInline() const noexcept
+    {
+        return m_ops && m_ops->is_inline;
+    }
+
+    template<class Func> static constexpr bool IsInlineable()
+    {
+        return sizeof(Func) <= INLINE_SIZE && alignof(Func) <= alignof(std::max_align_t)
+               && std::is_nothrow_move_constructible<Func>::value;
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void *storage);
+        void (*move)(void *dst, void *src);             //移动到dst并销毁src
+        void (*destroy)(void *storage);
+        bool is_inline;
+    };
+
+    template<class Func> struct InlineOps
+    {
+        static void Invoke(void *storage)
+        {
+            (*static_cast<Func *>(storage))();
+        }
+
+        static void Move(void *dst, void *src)
+        {
+            new (dst) Func(std::move(*static_cast<Func *>(src)));
+            static_cast<Func *>(src)->~Func();
+        }
+
+        static void Destroy(void *storage)
+        {
+            static_cast<Func *>(storage)->~Func();
+        }
+
+        static constexpr Ops ops = {Invoke, Move, Destroy, true};
+    };
+
+    template<class Func> struct HeapOps
+    {
+        static void Invoke(void *storage)
+        {
+            (**static_cast<Func **>(storage))();
+        }
+
+        static void Move(void *dst, void *src)
+        {
+            *static_cast<Func **>(dst) = *static_cast<Func **>(src);
+        }
+
+        static void Destroy(void *storage)
+        {
+            delete *static_cast<Func **>(storage);
+        }
+
+        static constexpr Ops ops = {Invoke, Move, Destroy, false};
+    };
+
+    void Reset() noexcept
+    {
+        if(m_ops)
+        {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    const Ops *m_ops;
+};
+
+template<class Func> constexpr Task::Ops Task::InlineOps<Func>::ops;
+template<class Func> constexpr Task::Ops Task::HeapOps<Func>::ops;
+
+#endif //ADVANCECODE_TASK_H
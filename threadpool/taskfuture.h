@@ -0,0 +1,320 @@
+//
+// Created by ciaowhen on 2023/5/14.
+//
+
+#ifndef ADVANCECODE_TASKFUTURE_H
+#define ADVANCECODE_TASKFUTURE_H
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//共享状态的对象池: 每个线程一条空闲链表, 状态对象在提交线程申请, 可以在任意线程释放
+template<class T>
+class StatePool
+{
+public:
+    static void *Allocate()
+    {
+        FreeList *free_list = GetFreeList();
+        if(free_list && !free_list->blocks.empty())
+        {
+            void *block = free_list->blocks.back();
+            free_list->blocks.pop_back();
+            return block;
+        }
+
+        return ::operator new(sizeof(T));
+    }
+
+    static void Deallocate(void *block)
+    {
+        FreeList *free_list = GetFreeList();
+        if(free_list && free_list->blocks.size() < MAX_CACHED)
+        {
+            free_list->blocks.push_back(block);
+            return;
+        }
+
+        ::operator delete(block);
+    }
+
+private:
+    static const size_t MAX_CACHED = 1024;
+
+    struct FreeList
+    {
+        std::vector<void *> blocks;
+
+        ~FreeList()
+        {
+            for(void *block : blocks)
+            {
+                ::operator delete(block);
+            }
+
+            blocks.clear();
+            IsDestroyed() = true;
+        }
+    };
+
+    static bool &IsDestroyed()
+    {
+        static thread_local bool destroyed = false;
+        return destroyed;
+    }
+
+    static FreeList *GetFreeList()
+    {
+        if(IsDestroyed())
+        {
+            return nullptr;
+        }
+
+        static thread_local FreeList free_list;
+        return &free_list;
+    }
+};
+
+//Submit返回值的共享状态, 引用计数归零后回到StatePool
+template<class R>
+class TaskState
+{
+public:
+    static TaskState *Create()
+    {
+        return new (StatePool<TaskState>::Allocate()) TaskState();
+    }
+
+    void AddRef()
+    {
+        m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Release()
+    {
+        if(m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            this->~TaskState();
+            StatePool<TaskState>::Deallocate(this);
+        }
+    }
+
+    template<class F> void Run(F &&func)
+    {
+        try
+        {
+            if constexpr(std::is_void<R>::value)
+            {
+                func();
+            }
+            else
+            {
+                new (&m_value) R(func());
+                m_has_value = true;
+            }
+        }
+        catch(...)
+        {
+            m_exception = std::current_exception();
+        }
+
+        SetReady();
+    }
+
+    void SetException(std::exception_ptr exception)
+    {
+        m_exception = exception;
+        SetReady();
+    }
+
+    bool IsReady() const
+    {
+        return m_ready.load(std::memory_order_acquire);
+    }
+
+    void Wait()
+    {
+        if(IsReady())
+        {
+            return;
+        }
+
+        std::unique_lock<std::mutex> locker(m_mutex);
+        m_cond.wait(locker, [this]{ return IsReady(); });
+    }
+
+    bool WaitFor(std::chrono::milliseconds timeout)
+    {
+        if(IsReady())
+        {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> locker(m_mutex);
+        return m_cond.wait_for(locker, timeout, [this]{ return IsReady(); });
+    }
+
+    R Get()
+    {
+        Wait();
+        if(m_exception)
+        {
+            std::rethrow_exception(m_exception);
+        }
+
+        if constexpr(!std::is_void<R>::value)
+        {
+            return std::move(*reinterpret_cast<R *>(&m_value));
+        }
+    }
+
+private:
+    TaskState():m_refs(1), m_ready(false), m_has_value(false)
+    {
+
+    }
+
+    ~TaskState()
+    {
+        if constexpr(!std::is_void<R>::value)
+        {
+            if(m_has_value)
+            {
+                reinterpret_cast<R *>(&m_value)->~R();
+            }
+        }
+    }
+
+    void SetReady()
+    {
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            m_ready.store(true, std::memory_order_release);
+        }
+
+        m_cond.notify_all();
+    }
+
+    typedef typename std::conditional<std::is_void<R>::value, char, R>::type ValueType;
+
+    std::atomic<int> m_refs;
+    std::atomic<bool> m_ready;
+    bool m_has_value;
+    std::exception_ptr m_exception;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    typename std::aligned_storage<sizeof(ValueType), alignof(ValueType)>::type m_value;
+};
+
+//任务一侧持有的句柄; 任务未执行就被丢弃时, 等待方会收到异常而不是永远阻塞
+template<class R>
+class TaskPromise
+{
+public:
+    explicit TaskPromise(TaskState<R> *state):m_state(state)
+    {
+        m_state->AddRef();
+    }
+
+    TaskPromise(TaskPromise &&other) noexcept : m_state(other.m_state)
+    {
+        other.m_state = nullptr;
+    }
+
+    TaskPromise(const TaskPromise &) = delete;
+    TaskPromise &operator=(const TaskPromise &) = delete;
+
+    ~TaskPromise()
+    {
+        if(m_state)
+        {
+            m_state->SetException(std::make_exception_ptr(std::runtime_error("task dropped before running")));
+            m_state->Release();
+        }
+    }
+
+    template<class F> void Run(F &&func)
+    {
+        assert(m_state);
+        m_state->Run(std::forward<F>(func));
+        m_state->Release();
+        m_state = nullptr;
+    }
+
+private:
+    TaskState<R> *m_state;
+};
+
+//ThreadPool::Submit返回的结果句柄, 只可移动, Get只能调用一次
+template<class R>
+class TaskFuture
+{
+public:
+    TaskFuture():m_state(nullptr) {}
+    explicit TaskFuture(TaskState<R> *state):m_state(state) {}
+
+    TaskFuture(TaskFuture &&other) noexcept : m_state(other.m_state)
+    {
+        other.m_state = nullptr;
+    }
+
+    TaskFuture &operator=(TaskFuture &&other) noexcept
+    {
+        if(this != &other)
+        {
+            if(m_state)
+            {
+                m_state->Release();
+            }
+
+            m_state = other.m_state;
+            other.m_state = nullptr;
+        }
+
+        return *this;
+    }
+
+    TaskFuture(const TaskFuture &) = delete;
+    TaskFuture &operator=(const TaskFuture &) = delete;
+
+    ~TaskFuture()
+    {
+        if(m_state)
+        {
+            m_state->Release();
+        }
+    }
+
+    bool IsValid() const { return m_state != nullptr; }
+    bool IsReady() const { return m_state && m_state->IsReady(); }
+    void Wait() { m_state->Wait(); }
+    bool WaitFor(std::chrono::milliseconds timeout) { return m_state->WaitFor(timeout); }
+
+    R Get()
+    {
+        assert(m_state);
+        TaskState<R> *state = m_state;
+        m_state = nullptr;
+        struct Releaser
+        {
+            TaskState<R> *state;
+            ~Releaser() { state->Release(); }
+        } releaser{state};
+
+        return state->Get();
+    }
+
+private:
+    TaskState<R> *m_state;
+};
+
+#endif //ADVANCECODE_TASKFUTURE_H
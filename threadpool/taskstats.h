@@ -0,0 +1,208 @@
+//
+// Created by ciaowhen on 2023/5/16.
+//
+
+#ifndef ADVANCECODE_TASKSTATS_H
+#define ADVANCECODE_TASKSTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+//HDR风格的直方图: 每个2的幂区间再线性分成SUB_BUCKETS份, 相对误差不超过1/SUB_BUCKETS, 覆盖全部uint64_t取值
+struct HistogramSnapshot
+{
+    static const size_t SUB_BUCKET_BITS = 4;
+    static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    std::vector<uint64_t> counts = std::vector<uint64_t>(BUCKET_COUNT, 0);
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    static size_t GetIndex(uint64_t value)
+    {
+        if(value < SUB_BUCKETS)
+        {
+            return static_cast<size_t>(value);
+        }
+
+        size_t shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return (shift + 1) * SUB_BUCKETS + static_cast<size_t>((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    //桶的下界
+    static uint64_t GetValue(size_t index)
+    {
+        if(index < SUB_BUCKETS)
+        {
+            return index;
+        }
+
+        size_t shift = index / SUB_BUCKETS - 1;
+        return (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+    }
+
+    //不是原子操作, 多个线程记录时由调用方加锁
+    void Record(uint64_t value)
+    {
+        counts[GetIndex(value)]++;
+        count++;
+        sum += value;
+        max = max > value ? max : value;
+    }
+
+    void Merge(const HistogramSnapshot &other)
+    {
+        for(size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            counts[i] += other.counts[i];
+        }
+
+        count += other.count;
+        sum += other.sum;
+        max = max > other.max ? max : other.max;
+    }
+
+    //percent取值0~100, 返回所在桶的下界
+    uint64_t GetPercentile(double percent) const
+    {
+        if(count == 0)
+        {
+            return 0;
+        }
+
+        uint64_t rank = static_cast<uint64_t>(percent / 100.0 * count + 0.5);
+        rank = rank == 0 ? 1 : rank;
+        uint64_t seen = 0;
+        for(size_t i = 0; i < BUCKET_COUNT; ++i)
+        {
+            seen += counts[i];
+            if(seen >= rank)
+            {
+                return GetValue(i);
+            }
+        }
+
+        return max;
+    }
+
+    double GetMean() const
+    {
+        return count == 0 ? 0 : static_cast<double>(sum) / count;
+    }
+
+    //以name为前缀追加分位数, 最大值, 个数与总和, 格式同TaskStatsSnapshot::ToString
+    void AppendTo(std::string &text, const char *name) const
+    {
+        static const double PERCENTS[] = {50, 90, 99, 99.9};
+        char line[256];
+        for(double percent : PERCENTS)
+        {
+            snprintf(line, sizeof(line), "%s{quantile=\"%g\"} %lu\n", name, percent / 100, static_cast<unsigned long>(GetPercentile(percent)));
+            text += line;
+        }
+
+        snprintf(line, sizeof(line), "%s_max %lu\n%s_count %lu\n%s_sum %lu\n", name, static_cast<unsigned long>(max),
+                 name, static_cast<unsigned long>(count), name, static_cast<unsigned long>(sum));
+        text += line;
+    }
+};
+
+//单写者多读者: 只由所属工作线程记录, 读取方随时取快照, 计数全部用relaxed原子操作, 不加锁
+class LatencyHistogram
+{
+public:
+    void Record(uint64_t value)
+    {
+        Bump(m_counts[HistogramSnapshot::GetIndex(value)], 1);
+        Bump(m_count, 1);
+        Bump(m_sum, value);
+        if(value > m_max.load(std::memory_order_relaxed))
+        {
+            m_max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    void AddTo(HistogramSnapshot &snapshot) const
+    {
+        for(size_t i = 0; i < HistogramSnapshot::BUCKET_COUNT; ++i)
+        {
+            snapshot.counts[i] += m_counts[i].load(std::memory_order_relaxed);
+        }
+
+        snapshot.count += m_count.load(std::memory_order_relaxed);
+        snapshot.sum += m_sum.load(std::memory_order_relaxed);
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        snapshot.max = snapshot.max > max ? snapshot.max : max;
+    }
+
+private:
+    //只有一个写者, 用load+store代替带锁前缀的fetch_add
+    static void Bump(std::atomic<uint64_t> &counter, uint64_t delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> m_counts[HistogramSnapshot::BUCKET_COUNT] = {};
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<uint64_t> m_sum{0};
+    std::atomic<uint64_t> m_max{0};
+};
+
+//每个工作线程一份, 独占缓存行, 避免线程之间的伪共享
+struct alignas(64) WorkerStats
+{
+    std::atomic<uint64_t> executed{0};
+    std::atomic<uint64_t> stolen{0};                    //窃取模式下从其他线程队列拿到的任务数
+    std::atomic<uint64_t> busy_ns{0};                   //执行任务的总耗时
+    LatencyHistogram queue_wait_ns;
+    LatencyHistogram run_ns;
+};
+
+struct WorkerStatsSnapshot
+{
+    uint64_t executed = 0;
+    uint64_t stolen = 0;
+    uint64_t busy_ns = 0;
+};
+
+//ThreadPool::GetTaskStats的返回值, 所有子池与工作线程的合计
+struct TaskStatsSnapshot
+{
+    uint64_t executed = 0;
+    uint64_t stolen = 0;
+    uint64_t busy_ns = 0;
+    HistogramSnapshot queue_wait_ns;
+    HistogramSnapshot run_ns;
+    std::vector<WorkerStatsSnapshot> workers;
+
+    //"名字 值"格式的文本, 每行一项, 便于直接打印或由采集程序解析
+    std::string ToString() const
+    {
+        std::string text;
+        char line[128];
+        snprintf(line, sizeof(line), "threadpool_tasks_executed %lu\n", static_cast<unsigned long>(executed));
+        text += line;
+        snprintf(line, sizeof(line), "threadpool_tasks_stolen %lu\n", static_cast<unsigned long>(stolen));
+        text += line;
+        snprintf(line, sizeof(line), "threadpool_busy_ns %lu\n", static_cast<unsigned long>(busy_ns));
+        text += line;
+        queue_wait_ns.AppendTo(text, "threadpool_queue_wait_ns");
+        run_ns.AppendTo(text, "threadpool_run_ns");
+        for(size_t i = 0; i < workers.size(); ++i)
+        {
+            snprintf(line, sizeof(line), "threadpool_worker_executed{worker=\"%zu\"} %lu\n", i, static_cast<unsigned long>(workers[i].executed));
+            text += line;
+            snprintf(line, sizeof(line), "threadpool_worker_busy_ns{worker=\"%zu\"} %lu\n", i, static_cast<unsigned long>(workers[i].busy_ns));
+            text += line;
+        }
+
+        return text;
+    }
+};
+
+#endif //ADVANCECODE_TASKSTATS_H
@@ -7,80 +7,935 @@
 
 #include <iostream>
 #include <queue>
+#include <deque>
+#include <vector>
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
 #include <functional>
+#include <tuple>
 #include <cassert>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <sched.h>
+#include "task.h"
+#include "taskfuture.h"
+#include "taskstats.h"
 
 class ThreadPool
 {
 public:
+    enum SCHEDULE_MODE
+    {
+        SM_SHARED_QUEUE = 0,                            //所有任务进入同一个队列
+        SM_WORK_STEALING,                               //每个工作线程一个本地队列, 空闲线程从其他线程窃取
+    };
+
+    enum FULL_POLICY
+    {
+        FP_REJECT = 0,                                  //队列满时拒绝, AddTask返回false
+        FP_BLOCK,                                       //队列满时阻塞提交线程直到有空位
+        FP_CALLER_RUNS,                                 //队列满时由提交线程直接执行
+    };
+
+    struct LaneConfig
+    {
+        size_t weight = 1;                              //加权轮询时每轮最多连续取出的任务数
+        size_t capacity = 0;                            //0表示不限长度
+        FULL_POLICY policy = FP_BLOCK;
+    };
+
+    struct LaneStats
+    {
+        size_t depth;                                   //当前排队任务数
+        size_t submitted;
+        size_t rejected;
+        size_t caller_runs;
+        size_t blocked;                                 //提交时因队列满而阻塞的次数
+    };
+
+    struct Config
+    {
+        size_t thread_count = 8;
+        SCHEDULE_MODE mode = SM_SHARED_QUEUE;
+        std::vector<LaneConfig> lanes;                  //为空时使用一条不限长度的队列
+        std::vector<std::vector<int>> cpu_sets;         //第i个工作线程绑定到cpu_sets[i % size], 为空时不绑定
+        bool numa_aware = false;                        //按NUMA节点拆分子池, 工作线程绑定到本节点CPU
+
+        //弹性伸缩, 仅共享队列模式: max_thread_count大于thread_count时开启, thread_count作为最少线程数
+        size_t max_thread_count = 0;
+        uint64_t target_wait_us = 1000;                 //排队等待p99超过该值时增加线程
+        uint64_t idle_timeout_ms = 10000;               //多于最少线程数时, 空闲超过该时间的线程退出
+
+        bool instrument = false;                        //记录每个任务的排队等待与执行耗时, 见GetTaskStats
+    };
+
     ThreadPool() = default;
     ThreadPool(ThreadPool &&) = default;
-    explicit ThreadPool(size_t thread_count = 8):m_pool(std::make_shared<Pool>())
+    explicit ThreadPool(size_t thread_count = 8, SCHEDULE_MODE mode = SM_SHARED_QUEUE):ThreadPool(MakeConfig(thread_count, mode))
+    {
+
+    }
+
+    explicit ThreadPool(const Config &config)
     {
-        assert(thread_count > 0);
-        for(int i = 0; i < thread_count; ++i)
+        assert(config.thread_count > 0);
+
+        //按NUMA节点把工作线程分成若干子池, 每个子池只在本节点的CPU上运行
+        std::vector<std::vector<int>> nodes;
+        if(config.numa_aware)
+        {
+            nodes = GetNumaNodes();
+        }
+
+        if(nodes.size() <= 1)
         {
-            std::thread([pool = m_pool]
+            nodes.assign(1, std::vector<int>());
+        }
+
+        const bool elastic = config.mode == SM_SHARED_QUEUE && config.max_thread_count > config.thread_count;
+        size_t group_count = std::min(nodes.size(), config.thread_count);
+        size_t worker_index = 0;
+        for(size_t group = 0; group < group_count; ++group)
+        {
+            size_t thread_count = SplitCount(config.thread_count, group, group_count);
+            size_t max_thread_count = elastic ? SplitCount(config.max_thread_count, group, group_count) : thread_count;
+            std::vector<std::vector<int>> worker_cpus(max_thread_count, nodes[group]);
+            for(auto &cpus : worker_cpus)
             {
-                std::unique_lock<std::mutex> locker(pool->mtx);
-                while (true)
+                if(!config.cpu_sets.empty())
                 {
-                    if(pool->is_close)
-                    {
-                        break;
-                    }
+                    cpus = config.cpu_sets[worker_index % config.cpu_sets.size()];
+                }
 
-                    if(!pool->tasks.empty())
-                    {
-                        auto do_task = std::move(pool->tasks.front());
-                        pool->tasks.pop();
-                        locker.unlock();
-                        do_task();
-                        locker.lock();
-                    }
-                    else
+                ++worker_index;
+            }
+
+            m_pools.push_back(CreatePool(config, thread_count, max_thread_count, worker_cpus));
+            for(int cpu : nodes[group])
+            {
+                if(cpu >= static_cast<int>(m_cpu_to_pool.size()))
+                {
+                    m_cpu_to_pool.resize(cpu + 1, 0);
+                }
+
+                m_cpu_to_pool[cpu] = group;
+            }
+        }
+    }
+
+    ~ThreadPool()
+    {
+        Shutdown(true);
+    }
+
+    //关闭线程池并等待所有工作线程退出; drain为true时先执行完已排队的任务, 否则丢弃共享队列中的任务
+    //之后的AddTask均返回false. 在本池的工作线程中调用时不等待自身
+    void Shutdown(bool drain = true)
+    {
+        for(auto &pool : m_pools)
+        {
+            std::deque<QueuedTask> dropped;
+            {
+                std::lock_guard<std::mutex> locker(pool->mtx);
+                if(!pool->is_close)
+                {
+                    pool->is_close = true;
+                    pool->drain = drain;
+                }
+
+                if(!pool->drain)
+                {
+                    for(auto &lane : pool->lanes)
                     {
-                        pool->cond.wait(locker);
+                        std::move(lane.tasks.begin(), lane.tasks.end(), std::back_inserter(dropped));
+                        lane.tasks.clear();
                     }
+
+                    pool->shared_count.store(0, std::memory_order_relaxed);
                 }
-            }).detach();
+            }
+
+            pool->cond.notify_all();
+            pool->not_full.notify_all();
+        }
+
+        for(auto &pool : m_pools)
+        {
+            std::vector<std::thread> threads;
+            {
+                std::lock_guard<std::mutex> locker(pool->mtx);
+                threads.swap(pool->threads);
+                std::move(pool->retired.begin(), pool->retired.end(), std::back_inserter(threads));
+                pool->retired.clear();
+            }
+
+            JoinThreads(threads);
         }
     }
 
-    ~ThreadPool()
+    template<class T> bool AddTask(T &&task)
+    {
+        return AddTask(0, std::forward<T>(task));
+    }
+
+    //提交到指定优先级队列; 窃取模式下工作线程内部提交的任务直接进入该线程的本地队列, 不受队列容量限制
+    //返回false表示任务被拒绝(队列满且策略为FP_REJECT, 或线程池已关闭)
+    //NUMA分组时, 任务优先进入提交线程所在节点的子池
+    template<class T> bool AddTask(size_t lane_index, T &&task)
     {
-        if(static_cast<bool>(m_pool))
+        WorkerContext &context = GetWorkerContext();
+        Pool *pool = SelectPool(context);
+        assert(lane_index < pool->lanes.size());
+        if(pool->mode == SM_WORK_STEALING && context.pool == pool)
         {
-            std::lock_guard<std::mutex> locker(m_pool->mtx);
-            m_pool->is_close = true;
+            Worker &worker = *pool->workers[context.index];
+            {
+                std::lock_guard<std::mutex> locker(worker.mtx);
+                worker.tasks.push_back(QueuedTask{Task(std::forward<T>(task)), pool->instrument ? NowNs() : 0});
+            }
+
+            pool->pending.fetch_add(1);
+            if(pool->idle.load() > 0)
+            {
+                std::lock_guard<std::mutex> locker(pool->mtx);
+                pool->cond.notify_one();
+            }
+
+            return true;
         }
 
-        m_pool->cond.notify_all();
+        std::unique_lock<std::mutex> locker(pool->mtx);
+        Lane &lane = pool->lanes[lane_index];
+        if(lane.config.capacity > 0 && lane.tasks.size() >= lane.config.capacity)
+        {
+            //工作线程自己阻塞在满队列上可能导致所有线程互等, 退化为由调用方执行
+            FULL_POLICY policy = lane.config.policy;
+            if(policy == FP_BLOCK && context.pool == pool)
+            {
+                policy = FP_CALLER_RUNS;
+            }
+
+            if(policy == FP_REJECT)
+            {
+                lane.rejected++;
+                return false;
+            }
+
+            if(policy == FP_CALLER_RUNS)
+            {
+                lane.caller_runs++;
+                locker.unlock();
+                Task caller_task(std::forward<T>(task));
+                caller_task();
+                return true;
+            }
+
+            lane.blocked++;
+            pool->blocked_count++;
+            pool->not_full.wait(locker, [&]{ return pool->is_close || lane.tasks.size() < lane.config.capacity; });
+            pool->blocked_count--;
+        }
+
+        if(pool->is_close)
+        {
+            lane.rejected++;
+            return false;
+        }
+
+        const uint64_t now = pool->elastic || pool->instrument ? NowNs() : 0;
+        lane.tasks.push_back(QueuedTask{Task(std::forward<T>(task)), now});
+        lane.submitted++;
+        pool->shared_count.fetch_add(1, std::memory_order_relaxed);
+        if(pool->elastic && ShouldGrowLocked(*pool, now))
+        {
+            SpawnWorkerLocked(*pool);
+        }
+
+        std::vector<std::thread> retired;
+        retired.swap(pool->retired);
+        locker.unlock();
+        pool->cond.notify_one();
+        JoinThreads(retired);
+        return true;
     }
 
-    template<class T> void AddTask(T &&task)
+    //提交任务并取得结果句柄, 参数按值保存到任务执行时; 共享状态来自StatePool, 不走通用堆分配
+    //任务被拒绝时, 返回句柄的Get会抛出异常
+    template<class F, class... Args>
+    auto Submit(F &&func, Args &&...args) -> TaskFuture<typename std::invoke_result<typename std::decay<F>::type, typename std::decay<Args>::type...>::type>
     {
+        return SubmitTo(0, std::forward<F>(func), std::forward<Args>(args)...);
+    }
+
+    template<class F, class... Args>
+    auto SubmitTo(size_t lane_index, F &&func, Args &&...args) -> TaskFuture<typename std::invoke_result<typename std::decay<F>::type, typename std::decay<Args>::type...>::type>
+    {
+        typedef typename std::invoke_result<typename std::decay<F>::type, typename std::decay<Args>::type...>::type Result;
+        TaskState<Result> *state = TaskState<Result>::Create();
+        TaskFuture<Result> future(state);
+        AddTask(lane_index, [promise = TaskPromise<Result>(state), func = std::forward<F>(func),
+                             params = std::make_tuple(std::forward<Args>(args)...)]() mutable
+        {
+            promise.Run([&]{ return std::apply(std::move(func), std::move(params)); });
+        });
+
+        return future;
+    }
+
+    size_t GetLaneCount() const
+    {
+        return m_pools.front()->lanes.size();
+    }
+
+    //多个NUMA子池时为各子池之和
+    LaneStats GetLaneStats(size_t lane_index) const
+    {
+        LaneStats stats = {0, 0, 0, 0, 0};
+        for(const auto &pool : m_pools)
+        {
+            assert(lane_index < pool->lanes.size());
+            std::lock_guard<std::mutex> locker(pool->mtx);
+            const Lane &lane = pool->lanes[lane_index];
+            stats.depth += lane.tasks.size();
+            stats.submitted += lane.submitted;
+            stats.rejected += lane.rejected;
+            stats.caller_runs += lane.caller_runs;
+            stats.blocked += lane.blocked;
+        }
+
+        return stats;
+    }
+
+    size_t GetQueueDepth() const
+    {
+        size_t depth = 0;
+        for(const auto &pool : m_pools)
+        {
+            depth += pool->shared_count.load(std::memory_order_relaxed) + pool->pending.load(std::memory_order_relaxed);
+        }
+
+        return depth;
+    }
+
+    //当前存活的工作线程数, 弹性模式下随负载变化
+    size_t GetThreadCount() const
+    {
+        size_t count = 0;
+        for(const auto &pool : m_pools)
         {
-            std::lock_guard<std::mutex> locker(m_pool->mtx);
-            m_pool->tasks.emplace(std::forward<T>(task));
+            std::lock_guard<std::mutex> locker(pool->mtx);
+            count += pool->live_threads;
         }
 
-        m_pool->cond.notify_one();
+        return count;
+    }
+
+    //各工作线程的计数与直方图合计; 未开启Config::instrument时全部为0
+    TaskStatsSnapshot GetTaskStats() const
+    {
+        TaskStatsSnapshot snapshot;
+        for(const auto &pool : m_pools)
+        {
+            std::lock_guard<std::mutex> locker(pool->mtx);
+            for(const auto &stats : pool->stats)
+            {
+                WorkerStatsSnapshot worker;
+                worker.executed = stats->executed.load(std::memory_order_relaxed);
+                worker.stolen = stats->stolen.load(std::memory_order_relaxed);
+                worker.busy_ns = stats->busy_ns.load(std::memory_order_relaxed);
+                snapshot.executed += worker.executed;
+                snapshot.stolen += worker.stolen;
+                snapshot.busy_ns += worker.busy_ns;
+                snapshot.workers.push_back(worker);
+                stats->queue_wait_ns.AddTo(snapshot.queue_wait_ns);
+                stats->run_ns.AddTo(snapshot.run_ns);
+            }
+        }
+
+        return snapshot;
+    }
+
+    size_t GetSubPoolCount() const
+    {
+        return m_pools.size();
+    }
+
+    //读取/sys下的NUMA拓扑, 每个元素为一个节点的CPU列表; 读取失败时返回空
+    static std::vector<std::vector<int>> GetNumaNodes()
+    {
+        std::vector<std::vector<int>> nodes;
+        for(int node = 0; ; ++node)
+        {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE *file = fopen(path, "r");
+            if(!file)
+            {
+                break;
+            }
+
+            char line[1024] = {0};
+            if(fgets(line, sizeof(line), file))
+            {
+                nodes.push_back(ParseCpuList(line));
+            }
+
+            fclose(file);
+        }
+
+        return nodes;
+    }
+
+    //解析"0-3,8-11"格式的CPU列表
+    static std::vector<int> ParseCpuList(const char *text)
+    {
+        std::vector<int> cpus;
+        while(*text)
+        {
+            char *end = nullptr;
+            long first = strtol(text, &end, 10);
+            if(end == text)
+            {
+                ++text;
+                continue;
+            }
+
+            long last = first;
+            text = end;
+            if(*text == '-')
+            {
+                last = strtol(text + 1, &end, 10);
+                text = end;
+            }
+
+            for(long cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(static_cast<int>(cpu));
+            }
+        }
+
+        return cpus;
     }
 
 private:
-    struct Pool
+    struct QueuedTask
+    {
+        Task task;
+        uint64_t enqueue_ns;                            //弹性模式或开启统计时才记录, 否则为0
+    };
+
+    struct Worker
+    {
+        std::mutex mtx;
+        std::deque<QueuedTask> tasks;
+    };
+
+    struct Lane
+    {
+        LaneConfig config;
+        std::deque<QueuedTask> tasks;
+        size_t submitted = 0;
+        size_t rejected = 0;
+        size_t caller_runs = 0;
+        size_t blocked = 0;
+    };
+
+    static const size_t WAIT_BUCKETS = 40;              //排队等待时间按2的幂(微秒)分桶
+    static const size_t WAIT_WINDOW_SAMPLES = 256;      //每积累这么多样本评估一次p99
+    static const uint64_t GROW_INTERVAL_NS = 1000000;   //两次扩容之间至少间隔1ms, 等新线程生效
+
+    struct Pool : public std::enable_shared_from_this<Pool>
     {
         std::mutex mtx;
         std::condition_variable cond;
-        bool is_close;
-        std::queue<std::function<void()>> tasks;
+        bool is_close = false;
+        bool drain = true;                              //关闭时是否执行完剩余任务
+        std::vector<std::thread> threads;               //由mtx保护
+        std::vector<std::thread> retired;               //已退出的弹性线程, 等待下次加锁时join
+        size_t live_threads = 0;
+
+        bool elastic = false;
+        size_t min_threads = 0;
+        size_t max_threads = 0;
+        uint64_t target_wait_ns = 0;
+        std::chrono::milliseconds idle_timeout{0};
+        std::vector<std::vector<int>> worker_cpus;      //第i个线程的绑核设置
+        size_t spawned = 0;                             //已创建过的线程数, 用于轮流选择worker_cpus
+        size_t wait_buckets[WAIT_BUCKETS] = {0};
+        size_t wait_samples = 0;
+        uint64_t last_grow_ns = 0;
+
+        bool instrument = false;
+        std::vector<std::unique_ptr<WorkerStats>> stats; //由mtx保护, 已退出线程的统计也保留
+        std::vector<Lane> lanes;                        //共享队列按优先级分道, 由mtx保护
+        size_t current_lane = 0;                        //加权轮询位置
+        size_t current_credit = 0;                      //当前队列本轮已取出的任务数
+        std::atomic<size_t> shared_count{0};            //共享队列总长度, 供无锁快速判空
+        std::condition_variable not_full;
+        size_t blocked_count = 0;                       //阻塞在满队列上的提交线程数
+
+        SCHEDULE_MODE mode = SM_SHARED_QUEUE;
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<size_t> pending{0};                 //所有本地队列中的任务数
+        std::atomic<size_t> idle{0};                    //正在等待的工作线程数
+    };
+
+    struct WorkerContext
+    {
+        Pool *pool = nullptr;
+        size_t index = 0;
+        WorkerStats *stats = nullptr;                   //未开启统计时为空
     };
 
-    std::shared_ptr<Pool> m_pool;
+    static Config MakeConfig(size_t thread_count, SCHEDULE_MODE mode)
+    {
+        Config config;
+        config.thread_count = thread_count;
+        config.mode = mode;
+        return config;
+    }
+
+    static size_t SplitCount(size_t total, size_t group, size_t group_count)
+    {
+        return total / group_count + (group < total % group_count ? 1 : 0);
+    }
+
+    static uint64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static std::shared_ptr<Pool> CreatePool(const Config &config, size_t thread_count, size_t max_thread_count,
+                                            const std::vector<std::vector<int>> &worker_cpus)
+    {
+        std::shared_ptr<Pool> pool = std::make_shared<Pool>();
+        pool->mode = config.mode;
+        std::vector<Lane> lanes(config.lanes.empty() ? 1 : config.lanes.size());
+        pool->lanes.swap(lanes);
+        for(size_t i = 0; i < config.lanes.size(); ++i)
+        {
+            assert(config.lanes[i].weight > 0);
+            pool->lanes[i].config = config.lanes[i];
+        }
+
+        pool->elastic = max_thread_count > thread_count;
+        pool->min_threads = thread_count;
+        pool->max_threads = max_thread_count;
+        pool->target_wait_ns = config.target_wait_us * 1000;
+        pool->idle_timeout = std::chrono::milliseconds(config.idle_timeout_ms);
+        pool->worker_cpus = worker_cpus;
+        pool->instrument = config.instrument;
+
+        std::lock_guard<std::mutex> locker(pool->mtx);
+        if(config.mode == SM_WORK_STEALING)
+        {
+            //先建好所有本地队列, 工作线程启动后才能互相窃取
+            for(size_t i = 0; i < thread_count; ++i)
+            {
+                pool->workers.emplace_back(new Worker);
+            }
+
+            for(size_t i = 0; i < thread_count; ++i)
+            {
+                pool->threads.emplace_back(RunStealingWorker, pool, i, worker_cpus[i], CreateStatsLocked(*pool));
+            }
+
+            pool->live_threads = thread_count;
+        }
+        else
+        {
+            for(size_t i = 0; i < thread_count; ++i)
+            {
+                SpawnWorkerLocked(*pool);
+            }
+        }
+
+        return pool;
+    }
+
+    //共享队列模式新增一个工作线程, 调用方需持有pool.mtx
+    static void SpawnWorkerLocked(Pool &pool)
+    {
+        const std::vector<int> &cpus = pool.worker_cpus[pool.spawned++ % pool.worker_cpus.size()];
+        pool.threads.emplace_back(RunSharedWorker, pool.shared_from_this(), cpus, CreateStatsLocked(pool));
+        pool.live_threads++;
+        pool.last_grow_ns = NowNs();
+    }
+
+    static WorkerStats *CreateStatsLocked(Pool &pool)
+    {
+        if(!pool.instrument)
+        {
+            return nullptr;
+        }
+
+        pool.stats.emplace_back(new WorkerStats);
+        return pool.stats.back().get();
+    }
+
+    //开启统计时记录排队等待与执行耗时, 任务析构也计入执行耗时
+    static void RunTask(QueuedTask &item, WorkerStats *stats)
+    {
+        if(!stats)
+        {
+            item.task();
+            item.task = nullptr;
+            return;
+        }
+
+        uint64_t begin = NowNs();
+        item.task();
+        item.task = nullptr;
+        uint64_t end = NowNs();
+        stats->queue_wait_ns.Record(begin - item.enqueue_ns);
+        stats->run_ns.Record(end - begin);
+        stats->executed.store(stats->executed.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        stats->busy_ns.store(stats->busy_ns.load(std::memory_order_relaxed) + end - begin, std::memory_order_relaxed);
+    }
+
+    //在本池工作线程中关闭时不能join自己, 改为分离
+    static void JoinThreads(std::vector<std::thread> &threads)
+    {
+        for(auto &thread : threads)
+        {
+            if(thread.get_id() == std::this_thread::get_id())
+            {
+                thread.detach();
+            }
+            else
+            {
+                thread.join();
+            }
+        }
+
+        threads.clear();
+    }
+
+    static void RecordWaitLocked(Pool &pool, uint64_t enqueue_ns)
+    {
+        uint64_t wait_us = (NowNs() - enqueue_ns) / 1000;
+        size_t bucket = 0;
+        while(wait_us > 0 && bucket + 1 < WAIT_BUCKETS)
+        {
+            wait_us >>= 1;
+            ++bucket;
+        }
+
+        pool.wait_buckets[bucket]++;
+        pool.wait_samples++;
+    }
+
+    //排队等待p99超过目标, 或者队首任务已经等得比目标还久且没有空闲线程时, 需要扩容
+    static bool ShouldGrowLocked(Pool &pool, uint64_t now)
+    {
+        if(pool.is_close || pool.live_threads >= pool.max_threads || pool.idle.load() > 0
+           || now - pool.last_grow_ns < GROW_INTERVAL_NS)
+        {
+            return false;
+        }
+
+        if(pool.wait_samples >= WAIT_WINDOW_SAMPLES)
+        {
+            size_t rank = pool.wait_samples - pool.wait_samples / 100;
+            size_t seen = 0;
+            uint64_t p99_us = 0;
+            for(size_t i = 0; i < WAIT_BUCKETS; ++i)
+            {
+                seen += pool.wait_buckets[i];
+                if(seen >= rank)
+                {
+                    p99_us = i == 0 ? 0 : (uint64_t(1) << (i - 1));
+                    break;
+                }
+            }
+
+            std::fill(pool.wait_buckets, pool.wait_buckets + WAIT_BUCKETS, 0);
+            pool.wait_samples = 0;
+            if(p99_us * 1000 > pool.target_wait_ns)
+            {
+                return true;
+            }
+        }
+
+        for(const auto &lane : pool.lanes)
+        {
+            if(!lane.tasks.empty() && now - lane.tasks.front().enqueue_ns > pool.target_wait_ns)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //空闲超时的弹性线程退出, 把自己的线程句柄交给下一个持锁者join
+    static bool RetireLocked(Pool &pool)
+    {
+        if(pool.is_close || pool.live_threads <= pool.min_threads)
+        {
+            return false;
+        }
+
+        for(auto it = pool.threads.begin(); it != pool.threads.end(); ++it)
+        {
+            if(it->get_id() == std::this_thread::get_id())
+            {
+                pool.retired.push_back(std::move(*it));
+                pool.threads.erase(it);
+                break;
+            }
+        }
+
+        pool.live_threads--;
+        return true;
+    }
+
+    //工作线程提交给自己所在的子池, 其他线程按当前CPU所属节点选择子池
+    Pool *SelectPool(const WorkerContext &context) const
+    {
+        if(m_pools.size() == 1)
+        {
+            return m_pools.front().get();
+        }
+
+        for(const auto &pool : m_pools)
+        {
+            if(context.pool == pool.get())
+            {
+                return pool.get();
+            }
+        }
+
+        int cpu = sched_getcpu();
+        if(cpu >= 0 && cpu < static_cast<int>(m_cpu_to_pool.size()))
+        {
+            return m_pools[m_cpu_to_pool[cpu]].get();
+        }
+
+        return m_pools.front().get();
+    }
+
+    static void PinCurrentThread(const std::vector<int> &cpus)
+    {
+        if(cpus.empty())
+        {
+            return;
+        }
+
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for(int cpu : cpus)
+        {
+            if(cpu >= 0 && cpu < CPU_SETSIZE)
+            {
+                CPU_SET(cpu, &cpu_set);
+            }
+        }
+
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    }
+
+    static WorkerContext &GetWorkerContext()
+    {
+        static thread_local WorkerContext context;
+        return context;
+    }
+
+    static void RunSharedWorker(std::shared_ptr<Pool> pool, std::vector<int> cpus, WorkerStats *stats)
+    {
+        PinCurrentThread(cpus);
+        GetWorkerContext().pool = pool.get();
+        GetWorkerContext().stats = stats;
+        QueuedTask do_task;
+        std::unique_lock<std::mutex> locker(pool->mtx);
+        while (true)
+        {
+            if(pool->is_close && (!pool->drain || pool->shared_count.load(std::memory_order_relaxed) == 0))
+            {
+                break;
+            }
+
+            if(PopLaneLocked(*pool, do_task))
+            {
+                //提交集中在一瞬间时, 后续扩容由取任务的工作线程判断
+                if(pool->elastic && ShouldGrowLocked(*pool, NowNs()))
+                {
+                    SpawnWorkerLocked(*pool);
+                }
+
+                locker.unlock();
+                RunTask(do_task, stats);
+                locker.lock();
+            }
+            else if(pool->elastic)
+            {
+                pool->idle.fetch_add(1);
+                bool timeout = pool->cond.wait_for(locker, pool->idle_timeout) == std::cv_status::timeout;
+                pool->idle.fetch_sub(1);
+                if(timeout && pool->shared_count.load(std::memory_order_relaxed) == 0 && RetireLocked(*pool))
+                {
+                    break;
+                }
+            }
+            else
+            {
+                pool->cond.wait(locker);
+            }
+        }
+
+        GetWorkerContext().pool = nullptr;
+        GetWorkerContext().stats = nullptr;
+    }
+
+    static void RunStealingWorker(std::shared_ptr<Pool> pool, size_t index, std::vector<int> cpus, WorkerStats *stats)
+    {
+        PinCurrentThread(cpus);
+        GetWorkerContext().pool = pool.get();
+        GetWorkerContext().index = index;
+        GetWorkerContext().stats = stats;
+
+        QueuedTask do_task;
+        while(true)
+        {
+            if(PopLocal(*pool, index, do_task) || PopShared(*pool, do_task) || Steal(*pool, index, do_task))
+            {
+                RunTask(do_task, stats);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> locker(pool->mtx);
+            if(pool->is_close)
+            {
+                break;
+            }
+
+            //先登记空闲再复查本地队列计数, 与AddTask中先加计数再查空闲配对, 不会漏掉唤醒
+            pool->idle.fetch_add(1);
+            bool has_task = pool->pending.load() > 0 || pool->shared_count.load() > 0;
+            if(!has_task)
+            {
+                pool->cond.wait(locker);
+            }
+
+            pool->idle.fetch_sub(1);
+            if(has_task)
+            {
+                //有任务但没抢到(其他线程正持有队列锁), 让出CPU后重试
+                locker.unlock();
+                std::this_thread::yield();
+            }
+        }
+
+        GetWorkerContext().pool = nullptr;
+        GetWorkerContext().stats = nullptr;
+    }
+
+    //本地队列按FIFO执行, 窃取者从尾部拿走最新的任务
+    static bool PopLocal(Pool &pool, size_t index, QueuedTask &task)
+    {
+        Worker &worker = *pool.workers[index];
+        std::lock_guard<std::mutex> locker(worker.mtx);
+        if(worker.tasks.empty())
+        {
+            return false;
+        }
+
+        task = std::move(worker.tasks.front());
+        worker.tasks.pop_front();
+        pool.pending.fetch_sub(1);
+        return true;
+    }
+
+    static bool PopShared(Pool &pool, QueuedTask &task)
+    {
+        //共享队列为空时不去抢全局锁
+        if(pool.shared_count.load(std::memory_order_relaxed) == 0)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> locker(pool.mtx);
+        return PopLaneLocked(pool, task);
+    }
+
+    //按权重轮询各优先级队列, 调用方需持有pool.mtx
+    static bool PopLaneLocked(Pool &pool, QueuedTask &task)
+    {
+        if(pool.shared_count.load(std::memory_order_relaxed) == 0)
+        {
+            return false;
+        }
+
+        const size_t lane_count = pool.lanes.size();
+        for(size_t tries = 0; tries <= lane_count; ++tries)
+        {
+            Lane &lane = pool.lanes[pool.current_lane];
+            if(!lane.tasks.empty() && pool.current_credit < lane.config.weight)
+            {
+                task = std::move(lane.tasks.front());
+                if(pool.elastic)
+                {
+                    RecordWaitLocked(pool, task.enqueue_ns);
+                }
+
+                lane.tasks.pop_front();
+                pool.current_credit++;
+                pool.shared_count.fetch_sub(1, std::memory_order_relaxed);
+                if(lane.config.capacity > 0 && pool.blocked_count > 0)
+                {
+                    pool.not_full.notify_all();
+                }
+
+                return true;
+            }
+
+            pool.current_lane = (pool.current_lane + 1) % lane_count;
+            pool.current_credit = 0;
+        }
+
+        return false;
+    }
+
+    static bool Steal(Pool &pool, size_t index, QueuedTask &task)
+    {
+        if(pool.pending.load() == 0)
+        {
+            return false;
+        }
+
+        const size_t worker_count = pool.workers.size();
+        for(size_t i = 1; i < worker_count; ++i)
+        {
+            Worker &victim = *pool.workers[(index + i) % worker_count];
+            std::unique_lock<std::mutex> locker(victim.mtx, std::try_to_lock);
+            if(!locker.owns_lock() || victim.tasks.empty())
+            {
+                continue;
+            }
+
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            pool.pending.fetch_sub(1);
+            WorkerStats *stats = GetWorkerContext().stats;
+            if(stats)
+            {
+                stats->stolen.store(stats->stolen.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            }
+
+            return true;
+        }
+
+        return false;
+    }
+
+    std::vector<std::shared_ptr<Pool>> m_pools;         //未开启NUMA分组时只有一个
+    std::vector<size_t> m_cpu_to_pool;                  //CPU编号到子池下标
 };
 
 #endif //ADVANCECODE_THREADPOOL_H
@@ -0,0 +1,149 @@
+//
+// Created by ciaowhen on 2023/5/20.
+//
+
+#include "../log/logbinary.h"
+#include "../log/logformat.h"
+#include "../log/logtime.h"
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//把Log二进制模式写出的文件还原成与文本模式一致的日志行, 输出到标准输出
+//用法: logdecoder [-u] file...      -u 时间带微秒
+namespace
+{
+    struct SiteInfo
+    {
+        int level;
+        std::string format;
+    };
+
+    bool ReadFile(const char *path, std::vector<char> &data)
+    {
+        FILE *file = fopen(path, "rb");
+        if(!file)
+        {
+            return false;
+        }
+
+        char block[64 * 1024];
+        size_t n = 0;
+        data.clear();
+        while((n = fread(block, 1, sizeof(block), file)) > 0)
+        {
+            data.insert(data.end(), block, block + n);
+        }
+
+        fclose(file);
+        return true;
+    }
+
+    void PrintLine(int level, uint64_t timestamp_ns, const char *body, size_t body_len, bool microseconds)
+    {
+        char line[LogTimestamp::MAX_LEN + 16];
+        size_t len = LogTimestamp::Format(line, static_cast<time_t>(timestamp_ns / 1000000000ull),
+                                          static_cast<long>(timestamp_ns % 1000000000ull / 1000), microseconds);
+        line[len++] = ' ';
+        size_t title_len = 0;
+        const char *title = LogFormat::GetLevelTitle(level, &title_len);
+        memcpy(line + len, title, title_len);
+        len += title_len;
+        fwrite(line, 1, len, stdout);
+        fwrite(body, 1, body_len, stdout);
+        fputc('\n', stdout);
+    }
+
+    //格式串字典跨文件保留, 按天或按行切分出的文件可以一起解码
+    bool DecodeFile(const char *path, std::unordered_map<uint32_t, SiteInfo> &sites, bool microseconds)
+    {
+        std::vector<char> data;
+        if(!ReadFile(path, data))
+        {
+            fprintf(stderr, "logdecoder: cannot open %s\n", path);
+            return false;
+        }
+
+        std::vector<char> body(64 * 1024);
+        LogBinary::Record record;
+        const char *pos = data.data();
+        const char *end = pos + data.size();
+        while(pos < end)
+        {
+            //mmap写的文件在进程异常退出时没有截断, 末尾是预分配的零
+            if(pos[0] == 0 && (end - pos < 2 || pos[1] == 0))
+            {
+                break;
+            }
+
+            const char *start = pos;
+            if(!LogBinary::Decode(pos, end, record))
+            {
+                fprintf(stderr, "logdecoder: %s: bad or truncated record at offset %zu\n", path, static_cast<size_t>(start - data.data()));
+                return false;
+            }
+
+            if(record.type == LogBinary::RT_FORMAT)
+            {
+                sites[record.id] = SiteInfo{record.level, record.format};
+            }
+            else if(record.type == LogBinary::RT_TEXT)
+            {
+                PrintLine(record.level, record.timestamp_ns, record.format.data(), record.format.size(), microseconds);
+            }
+            else if(record.type == LogBinary::RT_EVENT)
+            {
+                auto iter = sites.find(record.id);
+                if(iter == sites.end())
+                {
+                    int n = snprintf(body.data(), body.size(), "<unknown format #%u, %zu args>", record.id, record.args.size());
+                    PrintLine(-1, record.timestamp_ns, body.data(), static_cast<size_t>(n), microseconds);
+                    continue;
+                }
+
+                size_t len = LogBinary::Render(body.data(), body.size(), iter->second.format, record.args);
+                PrintLine(iter->second.level, record.timestamp_ns, body.data(), len, microseconds);
+            }
+        }
+
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    bool microseconds = false;
+    std::vector<const char *> paths;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i], "-u") == 0)
+        {
+            microseconds = true;
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if(paths.empty())
+    {
+        fprintf(stderr, "usage: %s [-u] file...\n", argv[0]);
+        return 2;
+    }
+
+    std::unordered_map<uint32_t, SiteInfo> sites;
+    int status = 0;
+    for(const char *path : paths)
+    {
+        if(!DecodeFile(path, sites, microseconds))
+        {
+            status = 1;
+        }
+    }
+
+    fflush(stdout);
+    return status;
+}